@@ -0,0 +1,226 @@
+#include "AsyncLogWriter.h"
+#include "ThreadTypes.h"
+
+#include <chrono>
+
+namespace tuya {
+
+namespace {
+
+// How long the idle writer sleeps before looking at the queue again. Records
+// wait at most that long unless the queue fills up or Flush() is called.
+constexpr std::chrono::milliseconds kWriterPeriod(5);
+
+size_t RoundUpPow2(size_t size) {
+  size_t n = 2;
+  while (n < size)
+    n <<= 1;
+  return n;
+}
+
+}  // namespace
+
+AsyncLogWriter& AsyncLogWriter::Instance() {
+  // Leaked on purpose, loggers may run during static destruction.
+  static AsyncLogWriter* const writer = new AsyncLogWriter();
+  return *writer;
+}
+
+void AsyncLogWriter::Start(const AsyncLoggingOptions& options) {
+  std::lock_guard<std::mutex> _(control_mutex_);
+  if (thread_.joinable())
+    return;
+
+  const size_t capacity = RoundUpPow2(options.capacity);
+  cells_.reset(new Cell[capacity]);
+  for (size_t i = 0; i < capacity; i++)
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  mask_ = capacity - 1;
+  overflow_ = options.overflow;
+  head_ = 0;
+  tail_.store(0, std::memory_order_relaxed);
+  enqueued_.store(0, std::memory_order_relaxed);
+  written_.store(0, std::memory_order_relaxed);
+  dropped_.store(0, std::memory_order_relaxed);
+  blocked_.store(0, std::memory_order_relaxed);
+
+  stopping_.store(false, std::memory_order_relaxed);
+  thread_ = std::thread(&AsyncLogWriter::Run, this);
+  writer_id_.store(thread_.get_id(), std::memory_order_relaxed);
+  accepting_.store(true, std::memory_order_seq_cst);
+}
+
+void AsyncLogWriter::Stop() {
+  std::lock_guard<std::mutex> _(control_mutex_);
+  if (!thread_.joinable())
+    return;
+
+  // New records go the synchronous way from now on, wait for the producers
+  // that got in before.
+  accepting_.store(false, std::memory_order_seq_cst);
+  while (producers_.load(std::memory_order_seq_cst) > 0)
+    std::this_thread::yield();
+
+  stopping_.store(true, std::memory_order_seq_cst);
+  WakeWriter();
+  thread_.join();
+}
+
+void AsyncLogWriter::Flush() {
+  if (!accepting_.load(std::memory_order_acquire) ||
+      std::this_thread::get_id() == writer_id_.load(std::memory_order_relaxed))
+    return;
+
+  // Every record claimed so far, published or about to be.
+  const uint64_t target = tail_.load(std::memory_order_acquire);
+  WakeWriter();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (written_.load(std::memory_order_acquire) < target) {
+    written_cv_.wait_for(lock, std::chrono::milliseconds(10));
+  }
+}
+
+bool AsyncLogWriter::Enqueue(LoggingSeverity severity,
+                             const char* tag,
+                             bool forced,
+                             std::string&& message) {
+  producers_.fetch_add(1, std::memory_order_seq_cst);
+  if (!accepting_.load(std::memory_order_seq_cst)) {
+    producers_.fetch_sub(1, std::memory_order_release);
+    return false;
+  }
+
+  bool pushed = TryPush(severity, tag, forced, message);
+  // The writer thread can't wait for itself.
+  if (!pushed && overflow_ == LogOverflowPolicy::kBlock &&
+      std::this_thread::get_id() != writer_id_.load(std::memory_order_relaxed)) {
+    blocked_.fetch_add(1, std::memory_order_relaxed);
+    for (int spins = 0; !pushed; spins++) {
+      WakeWriter();
+      if (spins < 64)
+        std::this_thread::yield();
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      pushed = TryPush(severity, tag, forced, message);
+    }
+  }
+
+  if (pushed) {
+    enqueued_.fetch_add(1, std::memory_order_relaxed);
+    // Let the writer batch up; only wake it early once a quarter is used.
+    const uint64_t used = tail_.load(std::memory_order_relaxed) -
+                          written_.load(std::memory_order_relaxed);
+    if (used > (mask_ + 1) / 4)
+      WakeWriter();
+  } else {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+  producers_.fetch_sub(1, std::memory_order_release);
+  return true;
+}
+
+AsyncLoggingStats AsyncLogWriter::GetStats() const {
+  AsyncLoggingStats stats;
+  stats.enqueued = enqueued_.load(std::memory_order_relaxed);
+  stats.written = written_.load(std::memory_order_relaxed);
+  stats.dropped = dropped_.load(std::memory_order_relaxed);
+  stats.blocked = blocked_.load(std::memory_order_relaxed);
+  stats.capacity = cells_ ? mask_ + 1 : 0;
+  return stats;
+}
+
+bool AsyncLogWriter::TryPush(LoggingSeverity severity,
+                             const char* tag,
+                             bool forced,
+                             std::string& message) {
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  Cell* cell;
+  for (;;) {
+    cell = &cells_[pos & mask_];
+    const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    const intptr_t diff =
+        static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      // The writer hasn't released that cell yet: full.
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->severity = severity;
+  cell->tag = tag;
+  cell->forced = forced;
+  cell->message = std::move(message);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool AsyncLogWriter::HasPending() const {
+  return cells_[head_ & mask_].sequence.load(std::memory_order_acquire) ==
+         head_ + 1;
+}
+
+bool AsyncLogWriter::TryPop(Cell* out) {
+  if (!HasPending())
+    return false;
+
+  Cell& cell = cells_[head_ & mask_];
+  out->severity = cell.severity;
+  out->tag = cell.tag;
+  out->forced = cell.forced;
+  out->message = std::move(cell.message);
+  cell.message.clear();
+  cell.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+  head_++;
+  return true;
+}
+
+void AsyncLogWriter::WakeWriter() {
+  // Pairs with the fence in Run(): either the writer sees the new record
+  // before sleeping, or we see it asleep.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> _(mutex_);
+    wake_.notify_one();
+  }
+}
+
+void AsyncLogWriter::Run() {
+  SetCurrentThreadName("log-writer");
+
+  Cell record;
+  for (;;) {
+    bool wrote = false;
+    while (TryPop(&record)) {
+      LogMessage::Dispatch(record.message, record.severity, record.tag,
+                           record.forced);
+      written_.fetch_add(1, std::memory_order_release);
+      wrote = true;
+    }
+    if (wrote) {
+      std::lock_guard<std::mutex> _(mutex_);
+      written_cv_.notify_all();
+    }
+
+    sleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+      // Checked under the lock WakeWriter() notifies with, so a wakeup
+      // can't slip in between.
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!HasPending()) {
+        if (stopping_.load(std::memory_order_acquire))
+          break;
+        wake_.wait_for(lock, kWriterPeriod);
+      }
+    }
+    sleeping_.store(false, std::memory_order_relaxed);
+  }
+  sleeping_.store(false, std::memory_order_relaxed);
+}
+
+}  // namespace tuya
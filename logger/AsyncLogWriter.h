@@ -0,0 +1,95 @@
+#ifndef __ASYNC_LOG_WRITER_H__
+#define __ASYNC_LOG_WRITER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Logging.h"
+
+namespace tuya {
+
+// Hands formatted log lines from any thread to a single writer thread that
+// calls the sinks, so a slow sink never stalls the logging thread.
+//
+// Records go through a bounded lock-free MPSC ring (Vyukov's bounded queue):
+// a producer claims a cell with one CAS on the tail and publishes it with a
+// release store of the cell's sequence, the writer is the only consumer.
+// The writer drains the ring every few milliseconds; producers only take a
+// lock to wake it early when the ring is filling up.
+class AsyncLogWriter {
+ public:
+  static AsyncLogWriter& Instance();
+
+  void Start(const AsyncLoggingOptions& options);
+  // Writes out everything queued so far, then stops the writer thread.
+  void Stop();
+  // Returns once every record queued before the call has been written.
+  void Flush();
+
+  // Returns false when the writer is not running and the caller has to
+  // write |message| itself.
+  bool Enqueue(LoggingSeverity severity,
+               const char* tag,
+               bool forced,
+               std::string&& message);
+
+  AsyncLoggingStats GetStats() const;
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    LoggingSeverity severity;
+    const char* tag;
+    bool forced;
+    std::string message;
+  };
+
+  AsyncLogWriter() = default;
+
+  bool TryPush(LoggingSeverity severity,
+               const char* tag,
+               bool forced,
+               std::string& message);
+  bool HasPending() const;
+  bool TryPop(Cell* out);
+  void WakeWriter();
+  void Run();
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_ = 0;
+  LogOverflowPolicy overflow_ = LogOverflowPolicy::kDrop;
+
+  // Producer side, on its own cache line.
+  alignas(64) std::atomic<size_t> tail_{0};
+  // Consumer side, writer thread only.
+  alignas(64) size_t head_ = 0;
+
+  // Producers currently inside Enqueue(), Stop() waits for them.
+  std::atomic<int> producers_{0};
+  std::atomic<bool> accepting_{false};
+  std::atomic<bool> stopping_{false};
+  std::atomic<bool> sleeping_{false};
+
+  std::atomic<uint64_t> enqueued_{0};
+  std::atomic<uint64_t> written_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> blocked_{0};
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable written_cv_;
+  std::mutex control_mutex_;
+  std::thread thread_;
+  std::atomic<std::thread::id> writer_id_{};
+};
+
+}  // namespace tuya
+
+#endif  // __ASYNC_LOG_WRITER_H__
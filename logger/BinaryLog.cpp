@@ -0,0 +1,482 @@
+#include "BinaryLog.h"
+#include "ThreadTypes.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace tuya {
+
+// Logging.cpp
+const char* FilenameFromPath(const char* file);
+
+namespace {
+
+constexpr char kMagic[7] = {'N', 'D', 'C', 'P', 'B', 'L', 'G'};
+// Header of an event: kind, site, time, thread, args length.
+constexpr size_t kEventHeaderSize = 1 + 4 + 8 + 4 + 2;
+constexpr size_t kThreadBufferSize = 64 * 1024;
+
+struct Site {
+  const char* file;
+  int line;
+  LoggingSeverity severity;
+};
+
+// A thread's pending records. The owner appends under |lock|, which is only
+// contended while Flush() or Stop() write the buffer out.
+//
+// Lock order: State::registry_mutex, then ThreadBuffer::lock, then
+// State::mutex.
+struct ThreadBuffer {
+  std::atomic_flag lock = ATOMIC_FLAG_INIT;
+  size_t used = 0;
+  char data[kThreadBufferSize];
+
+  void Lock() {
+    while (lock.test_and_set(std::memory_order_acquire)) {
+    }
+  }
+  void Unlock() { lock.clear(std::memory_order_release); }
+};
+
+// Sites, thread buffers and the file. Leaked, threads may log during static
+// destruction.
+struct State {
+  // The file and the sites.
+  std::mutex mutex;
+  FILE* file = nullptr;
+  uint64_t bytes = 0;
+  std::vector<Site> sites;
+  std::map<std::pair<const char*, int>, uint32_t> site_ids;
+  std::vector<std::string_view> strings;
+  std::map<const char*, uint32_t> string_ids;
+  // Live thread buffers.
+  std::mutex registry_mutex;
+  std::vector<ThreadBuffer*> buffers;
+};
+
+State& GetState() {
+  static State* const state = new State();
+  return *state;
+}
+
+// Needs state.mutex.
+void WriteLocked(State& state, const void* data, size_t size) {
+  if (state.file == nullptr || size == 0)
+    return;
+  fwrite(data, 1, size, state.file);
+  state.bytes += size;
+}
+
+void WriteSiteLocked(State& state, uint32_t id) {
+  const Site& site = state.sites[id];
+  const char* file = FilenameFromPath(site.file);
+  const uint16_t len = static_cast<uint16_t>(std::min<size_t>(strlen(file), 0xffff));
+  const uint8_t kind = BinaryLog::kSite;
+  const uint8_t severity = static_cast<uint8_t>(site.severity);
+  const uint32_t line = static_cast<uint32_t>(site.line);
+  WriteLocked(state, &kind, 1);
+  WriteLocked(state, &id, 4);
+  WriteLocked(state, &severity, 1);
+  WriteLocked(state, &line, 4);
+  WriteLocked(state, &len, 2);
+  WriteLocked(state, file, len);
+}
+
+void WriteStringLocked(State& state, uint32_t id) {
+  const std::string_view str = state.strings[id];
+  const uint16_t len = static_cast<uint16_t>(std::min<size_t>(str.size(), 0xffff));
+  const uint8_t kind = BinaryLog::kString;
+  WriteLocked(state, &kind, 1);
+  WriteLocked(state, &id, 4);
+  WriteLocked(state, &len, 2);
+  WriteLocked(state, str.data(), len);
+}
+
+// Needs buffer->lock.
+void FlushBuffer(ThreadBuffer* buffer) {
+  if (buffer->used == 0)
+    return;
+  State& state = GetState();
+  std::lock_guard<std::mutex> _(state.mutex);
+  WriteLocked(state, buffer->data, buffer->used);
+  buffer->used = 0;
+}
+
+// Registers the thread's buffer on first use, writes it out when the thread
+// exits.
+class LocalBuffer {
+ public:
+  LocalBuffer() {
+    State& state = GetState();
+    std::lock_guard<std::mutex> _(state.registry_mutex);
+    state.buffers.push_back(&buffer_);
+  }
+  ~LocalBuffer() {
+    State& state = GetState();
+    std::lock_guard<std::mutex> _(state.registry_mutex);
+    buffer_.Lock();
+    FlushBuffer(&buffer_);
+    buffer_.Unlock();
+    state.buffers.erase(
+        std::remove(state.buffers.begin(), state.buffers.end(), &buffer_),
+        state.buffers.end());
+  }
+  ThreadBuffer* get() { return &buffer_; }
+
+ private:
+  ThreadBuffer buffer_;
+};
+
+uint64_t NowMicros() {
+  struct timespec ts;
+#if defined(WIN)
+  timespec_get(&ts, TIME_UTC);
+#else
+  clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t LocalThreadId() {
+  static thread_local const uint32_t id =
+      static_cast<uint32_t>(CurrentThreadId());
+  return id;
+}
+
+template <typename T>
+bool Read(const char*& p, const char* end, T* value) {
+  if (static_cast<size_t>(end - p) < sizeof(T))
+    return false;
+  memcpy(value, p, sizeof(T));
+  p += sizeof(T);
+  return true;
+}
+
+struct Event {
+  uint64_t time;
+  uint32_t thread;
+  uint32_t site;
+  std::string args;
+};
+
+// Renders the arguments of an event, false if they are malformed.
+bool RenderArgs(const char* p,
+                const char* end,
+                const std::map<uint32_t, std::string>& strings,
+                std::string* out) {
+  char buf[32];
+  while (p < end) {
+    uint8_t type;
+    if (!Read(p, end, &type))
+      return false;
+    int len = 0;
+    switch (static_cast<LogArgType>(type)) {
+      case LogArgType::kInt: {
+        int32_t v;
+        if (!Read(p, end, &v))
+          return false;
+        len = snprintf(buf, sizeof(buf), "%" PRId32, v);
+        break;
+      }
+      case LogArgType::kUInt: {
+        uint32_t v;
+        if (!Read(p, end, &v))
+          return false;
+        len = snprintf(buf, sizeof(buf), "%" PRIu32, v);
+        break;
+      }
+      case LogArgType::kLongLong: {
+        int64_t v;
+        if (!Read(p, end, &v))
+          return false;
+        len = snprintf(buf, sizeof(buf), "%" PRId64, v);
+        break;
+      }
+      case LogArgType::kULongLong: {
+        uint64_t v;
+        if (!Read(p, end, &v))
+          return false;
+        len = snprintf(buf, sizeof(buf), "%" PRIu64, v);
+        break;
+      }
+      case LogArgType::kDouble: {
+        double v;
+        if (!Read(p, end, &v))
+          return false;
+        len = snprintf(buf, sizeof(buf), "%g", v);
+        break;
+      }
+      case LogArgType::kVoidP: {
+        uint64_t v;
+        if (!Read(p, end, &v))
+          return false;
+        len = snprintf(buf, sizeof(buf), "0x%" PRIx64, v);
+        break;
+      }
+      case LogArgType::kCharP: {
+        uint32_t id;
+        if (!Read(p, end, &id))
+          return false;
+        auto it = strings.find(id);
+        if (it == strings.end())
+          return false;
+        out->append(it->second);
+        continue;
+      }
+      case LogArgType::kStringView: {
+        uint16_t n;
+        if (!Read(p, end, &n) || end - p < n)
+          return false;
+        out->append(p, n);
+        p += n;
+        continue;
+      }
+      default:
+        return false;
+    }
+    out->append(buf, len);
+  }
+  return true;
+}
+
+}  // namespace
+
+std::atomic<int> BinaryLog::min_sev_{LS_NONE};
+
+bool BinaryLog::Start(const char* path, LoggingSeverity min_sev) {
+  State& state = GetState();
+  {
+    std::lock_guard<std::mutex> _(state.mutex);
+    if (state.file != nullptr)
+      return false;
+    state.file = fopen(path, "wb");
+    if (state.file == nullptr)
+      return false;
+    state.bytes = 0;
+    WriteLocked(state, kMagic, sizeof(kMagic));
+    WriteLocked(state, &kVersion, 1);
+    // Sites registered during an earlier run keep their IDs.
+    for (uint32_t id = 0; id < state.sites.size(); id++)
+      WriteSiteLocked(state, id);
+    for (uint32_t id = 0; id < state.strings.size(); id++)
+      WriteStringLocked(state, id);
+  }
+  min_sev_.store(min_sev, std::memory_order_relaxed);
+  return true;
+}
+
+void BinaryLog::Stop() {
+  min_sev_.store(LS_NONE, std::memory_order_relaxed);
+  Flush();
+  State& state = GetState();
+  std::lock_guard<std::mutex> _(state.mutex);
+  if (state.file != nullptr) {
+    fclose(state.file);
+    state.file = nullptr;
+  }
+}
+
+void BinaryLog::Flush() {
+  State& state = GetState();
+  {
+    std::lock_guard<std::mutex> _(state.registry_mutex);
+    for (ThreadBuffer* buffer : state.buffers) {
+      buffer->Lock();
+      FlushBuffer(buffer);
+      buffer->Unlock();
+    }
+  }
+  std::lock_guard<std::mutex> _(state.mutex);
+  if (state.file != nullptr)
+    fflush(state.file);
+}
+
+uint32_t BinaryLog::RegisterSite(const char* file,
+                                 int line,
+                                 LoggingSeverity sev) {
+  State& state = GetState();
+  std::lock_guard<std::mutex> _(state.mutex);
+  auto it = state.site_ids.find(std::make_pair(file, line));
+  if (it != state.site_ids.end())
+    return it->second;
+
+  const uint32_t id = static_cast<uint32_t>(state.sites.size());
+  state.sites.push_back(Site{file, line, sev});
+  state.site_ids.emplace(std::make_pair(file, line), id);
+  // Written straight away so it precedes every event of the site.
+  WriteSiteLocked(state, id);
+  return id;
+}
+
+uint32_t BinaryLog::RegisterString(const char* s, size_t len) {
+  State& state = GetState();
+  std::lock_guard<std::mutex> _(state.mutex);
+  auto it = state.string_ids.find(s);
+  if (it != state.string_ids.end())
+    return it->second;
+
+  const uint32_t id = static_cast<uint32_t>(state.strings.size());
+  state.strings.emplace_back(s, len);
+  state.string_ids.emplace(s, id);
+  WriteStringLocked(state, id);
+  return id;
+}
+
+uint64_t BinaryLog::BytesWritten() {
+  State& state = GetState();
+  std::lock_guard<std::mutex> _(state.mutex);
+  return state.bytes;
+}
+
+void BinaryLog::Append(const char* record, size_t size) {
+  static thread_local LocalBuffer local;
+  ThreadBuffer* buffer = local.get();
+  buffer->Lock();
+  if (buffer->used + size > kThreadBufferSize)
+    FlushBuffer(buffer);
+  memcpy(buffer->data + buffer->used, record, size);
+  buffer->used += size;
+  buffer->Unlock();
+}
+
+bool BinaryLog::Decode(const char* data, size_t size, std::string* text) {
+  const char* p = data;
+  const char* end = data + size;
+  if (size < sizeof(kMagic) + 1 || memcmp(p, kMagic, sizeof(kMagic)) != 0 ||
+      static_cast<uint8_t>(p[sizeof(kMagic)]) != kVersion)
+    return false;
+  p += sizeof(kMagic) + 1;
+
+  std::map<uint32_t, std::pair<std::string, uint32_t>> sites;
+  std::map<uint32_t, std::string> strings;
+  std::vector<Event> events;
+  bool ok = true;
+  while (p < end && ok) {
+    uint8_t kind;
+    if (!Read(p, end, &kind)) {
+      ok = false;
+    } else if (kind == kSite) {
+      uint32_t id, line;
+      uint8_t severity;
+      uint16_t len;
+      ok = Read(p, end, &id) && Read(p, end, &severity) &&
+           Read(p, end, &line) && Read(p, end, &len) && end - p >= len;
+      if (ok) {
+        sites[id] = std::make_pair(std::string(p, len), line);
+        p += len;
+      }
+    } else if (kind == kString) {
+      uint32_t id;
+      uint16_t len;
+      ok = Read(p, end, &id) && Read(p, end, &len) && end - p >= len;
+      if (ok) {
+        strings[id] = std::string(p, len);
+        p += len;
+      }
+    } else if (kind == kEvent) {
+      Event event;
+      uint16_t len;
+      ok = Read(p, end, &event.site) && Read(p, end, &event.time) &&
+           Read(p, end, &event.thread) && Read(p, end, &len) &&
+           end - p >= len && RenderArgs(p, p + len, strings, &event.args);
+      if (ok) {
+        p += len;
+        events.push_back(std::move(event));
+      }
+    } else {
+      ok = false;
+    }
+  }
+
+  std::stable_sort(events.begin(), events.end(),
+                   [](const Event& a, const Event& b) { return a.time < b.time; });
+  for (const Event& event : events) {
+    const time_t seconds = static_cast<time_t>(event.time / 1000000);
+    struct tm tm;
+#if defined(WIN)
+    localtime_s(&tm, &seconds);
+#else
+    localtime_r(&seconds, &tm);
+#endif
+    char prefix[64];
+    int len = snprintf(prefix, sizeof(prefix),
+                       "%4d-%02d-%02d %02d:%02d:%02d:%03d[%" PRIu32 "] ",
+                       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                       tm.tm_min, tm.tm_sec,
+                       static_cast<int>(event.time % 1000000 / 1000),
+                       event.thread);
+    text->append(prefix, len);
+    auto site = sites.find(event.site);
+    if (site != sites.end()) {
+      text->append("(").append(site->second.first).append(":");
+      text->append(std::to_string(site->second.second)).append("): ");
+    } else {
+      ok = false;
+    }
+    text->append(event.args).append("\n");
+  }
+  return ok;
+}
+
+BinaryLogLine::BinaryLogLine(uint32_t site) : size_(kEventHeaderSize) {
+  const uint64_t time = NowMicros();
+  const uint32_t thread = LocalThreadId();
+  record_[0] = BinaryLog::kEvent;
+  memcpy(record_ + 1, &site, 4);
+  memcpy(record_ + 5, &time, 8);
+  memcpy(record_ + 13, &thread, 4);
+}
+
+BinaryLogLine::~BinaryLogLine() {
+  const uint16_t len = static_cast<uint16_t>(size_ - kEventHeaderSize);
+  memcpy(record_ + 17, &len, 2);
+  BinaryLog::Append(record_, size_);
+}
+
+BinaryLogLine& BinaryLogLine::Put(LogArgType type,
+                                  const void* value,
+                                  size_t size) {
+  if (size_ + 1 + size <= kMaxRecordSize) {
+    record_[size_] = static_cast<char>(type);
+    memcpy(record_ + size_ + 1, value, size);
+    size_ += 1 + size;
+  }
+  return *this;
+}
+
+BinaryLogLine& BinaryLogLine::PutLiteral(const char* s, size_t len) {
+  // Per-thread cache in front of the registry, literals repeat a lot.
+  struct Entry {
+    const char* str;
+    uint32_t id;
+  };
+  static thread_local Entry cache[256];
+  Entry& entry = cache[(reinterpret_cast<uintptr_t>(s) >> 2) % 256];
+  if (entry.str != s) {
+    entry.id = BinaryLog::RegisterString(s, len);
+    entry.str = s;
+  }
+  return Put(LogArgType::kCharP, &entry.id, 4);
+}
+
+BinaryLogLine& BinaryLogLine::PutString(const char* s, size_t len) {
+  if (size_ + 3 >= kMaxRecordSize)
+    return *this;
+  const uint16_t n =
+      static_cast<uint16_t>(std::min(len, kMaxRecordSize - size_ - 3));
+  record_[size_] = static_cast<char>(LogArgType::kStringView);
+  memcpy(record_ + size_ + 1, &n, 2);
+  memcpy(record_ + size_ + 3, s, n);
+  size_ += 3 + n;
+  return *this;
+}
+
+}  // namespace tuya
@@ -0,0 +1,192 @@
+#ifndef __BINARY_LOG_H__
+#define __BINARY_LOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "Logging.h"
+
+namespace tuya {
+
+// Binary log mode: call sites write a static site ID (file, line, severity,
+// registered once per call site) and their raw typed arguments, tagged with
+// LogArgType, into a per-thread buffer. String literals wrapped in
+// BINLOG_LIT() are registered once like sites and written as an ID, other
+// strings are copied. No number or timestamp is formatted
+// on the logging thread; a buffer only reaches the file, under a lock, when
+// it is full or flushed. Decode() (and the logDecoder tool) renders the text
+// offline or on demand.
+//
+// File layout, native byte order:
+//   header  "NDCPBLG" kVersion
+//   site    kSite  u32 id, u8 severity, u32 line, u16 len, file
+//   string  kString u32 id, u16 len, bytes
+//   event   kEvent u32 site, u64 time (us since epoch), u32 thread,
+//                  u16 len, args: u8 LogArgType + value, strings as u16 len
+//                  + bytes, literals (kCharP) as u32 string id
+// Site and string records always precede the events that use them. Events of different
+// threads are interleaved a buffer at a time, the decoder orders them by time.
+class BinaryLog {
+ public:
+  enum RecordKind : uint8_t {
+    kSite = 1,
+    kEvent = 2,
+    kString = 3,
+  };
+  static constexpr uint8_t kVersion = 1;
+
+  // Writes records of |min_sev| and above to |path|, truncating it.
+  static bool Start(const char* path, LoggingSeverity min_sev);
+  // Writes out every thread's buffer and closes the file.
+  static void Stop();
+  // Writes out every thread's buffer.
+  static void Flush();
+
+  static bool IsOn(LoggingSeverity sev) {
+    return sev >= min_sev_.load(std::memory_order_relaxed) && sev < LS_NONE;
+  }
+
+  // Returns the ID of a call site. BLOG() calls it once per site, the same
+  // file pointer and line always get the same ID.
+  static uint32_t RegisterSite(const char* file,
+                               int line,
+                               LoggingSeverity sev);
+
+  // Returns the ID of a string literal, the same pointer always gets the
+  // same ID.
+  static uint32_t RegisterString(const char* s, size_t len);
+
+  // Renders a binary log the way LogMessage prints with timestamps and
+  // threads on. Returns false if |data| is malformed or truncated, |text|
+  // then holds what could be decoded.
+  static bool Decode(const char* data, size_t size, std::string* text);
+
+  // Bytes handed to the file since Start().
+  static uint64_t BytesWritten();
+
+ private:
+  friend class BinaryLogLine;
+
+  static void Append(const char* record, size_t size);
+
+  static std::atomic<int> min_sev_;
+};
+
+// A string literal, logged by address, see BINLOG_LIT().
+struct BinaryLogLiteral {
+  const char* s;
+  size_t len;
+};
+
+// One event being encoded on the stack, appended to the thread's buffer when
+// destroyed. Arguments that don't fit in kMaxRecordSize are cut.
+class BinaryLogLine {
+ public:
+  explicit BinaryLogLine(uint32_t site);
+  ~BinaryLogLine();
+
+  BinaryLogLine(const BinaryLogLine&) = delete;
+  BinaryLogLine& operator=(const BinaryLogLine&) = delete;
+
+  BinaryLogLine& operator<<(bool b) { return *this << static_cast<int>(b); }
+  BinaryLogLine& operator<<(char c) { return PutString(&c, 1); }
+  BinaryLogLine& operator<<(short i) { return *this << static_cast<int>(i); }
+  BinaryLogLine& operator<<(unsigned short i) {
+    return *this << static_cast<unsigned>(i);
+  }
+  BinaryLogLine& operator<<(int i) { return Put(LogArgType::kInt, &i, 4); }
+  BinaryLogLine& operator<<(unsigned i) {
+    return Put(LogArgType::kUInt, &i, 4);
+  }
+  BinaryLogLine& operator<<(long i) {  // NOLINT
+    int64_t v = i;
+    return Put(LogArgType::kLongLong, &v, 8);
+  }
+  BinaryLogLine& operator<<(long long i) {  // NOLINT
+    int64_t v = i;
+    return Put(LogArgType::kLongLong, &v, 8);
+  }
+  BinaryLogLine& operator<<(unsigned long i) {  // NOLINT
+    uint64_t v = i;
+    return Put(LogArgType::kULongLong, &v, 8);
+  }
+  BinaryLogLine& operator<<(unsigned long long i) {  // NOLINT
+    uint64_t v = i;
+    return Put(LogArgType::kULongLong, &v, 8);
+  }
+  BinaryLogLine& operator<<(double d) {
+    return Put(LogArgType::kDouble, &d, 8);
+  }
+  BinaryLogLine& operator<<(float f) { return *this << static_cast<double>(f); }
+  BinaryLogLine& operator<<(long double d) {
+    return *this << static_cast<double>(d);
+  }
+  BinaryLogLine& operator<<(BinaryLogLiteral literal) {
+    return PutLiteral(literal.s, literal.len);
+  }
+  // Arrays may be buffers as well as literals, so they are copied.
+  template <size_t N>
+  BinaryLogLine& operator<<(const char (&s)[N]) {
+    return PutString(s, strnlen(s, N));
+  }
+  template <size_t N>
+  BinaryLogLine& operator<<(char (&s)[N]) {
+    return PutString(s, strnlen(s, N));
+  }
+  template <typename T,
+            typename std::enable_if<std::is_same<T, const char*>::value ||
+                                        std::is_same<T, char*>::value,
+                                    int>::type = 0>
+  BinaryLogLine& operator<<(T s) {
+    return s ? PutString(s, strlen(s)) : PutLiteral("(null)", 6);
+  }
+  BinaryLogLine& operator<<(const std::string& s) {
+    return PutString(s.data(), s.size());
+  }
+  BinaryLogLine& operator<<(std::string_view s) {
+    return PutString(s.data(), s.size());
+  }
+  BinaryLogLine& operator<<(const void* p) {
+    uint64_t v = reinterpret_cast<uintptr_t>(p);
+    return Put(LogArgType::kVoidP, &v, 8);
+  }
+
+  static constexpr size_t kMaxRecordSize = 2048;
+
+ private:
+  BinaryLogLine& Put(LogArgType type, const void* value, size_t size);
+  BinaryLogLine& PutString(const char* s, size_t len);
+  BinaryLogLine& PutLiteral(const char* s, size_t len);
+
+  size_t size_;
+  char record_[kMaxRecordSize];
+};
+
+}  // namespace tuya
+
+// Per call site ID, registered the first time the site logs.
+#define TUYA_BINARY_LOG_SITE(sev)                                      \
+  [] {                                                                 \
+    static const uint32_t site =                                       \
+        tuya::BinaryLog::RegisterSite(__FILE__, __LINE__, sev);        \
+    return site;                                                       \
+  }()
+
+// Logs a string literal as an ID: BLOGI << BINLOG_LIT("accepted ") << fd;
+// Anything but a literal fails to compile.
+#define BINLOG_LIT(s) (tuya::BinaryLogLiteral{"" s, sizeof("" s) - 1})
+
+#define BLOG(sev) \
+  if (tuya::BinaryLog::IsOn(sev)) tuya::BinaryLogLine(TUYA_BINARY_LOG_SITE(sev))
+#define BLOGV BLOG(tuya::LS_VERBOSE)
+#define BLOGI BLOG(tuya::LS_INFO)
+#define BLOGW BLOG(tuya::LS_WARNING)
+#define BLOGE BLOG(tuya::LS_ERROR)
+
+#endif  // __BINARY_LOG_H__
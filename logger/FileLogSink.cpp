@@ -0,0 +1,314 @@
+#include "FileLogSink.h"
+#include "ThreadTypes.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace tuya {
+
+namespace {
+
+// Backoff between attempts to open a file after one failed.
+const int kMinRetryMs = 1000;
+const int kMaxRetryMs = 60000;
+
+int64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t PageSize() {
+  static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return page_size;
+}
+
+// Reserves the blocks of the whole file up front where the platform allows
+// it, so running out of disk fails here rather than as a SIGBUS on a write
+// through the mapping.
+bool Preallocate(int fd, size_t size) {
+#if defined(__LINUX__) || defined(__ANDROID__)
+  if (posix_fallocate(fd, 0, static_cast<off_t>(size)) == 0)
+    return true;
+#endif
+  return ftruncate(fd, static_cast<off_t>(size)) == 0;
+}
+
+}  // namespace
+
+FileLogSink::Mapping::~Mapping() {
+  if (data != nullptr)
+    munmap(data, size);
+  if (fd >= 0) {
+    // Drop the zeros past the last line.
+    if (ftruncate(fd, static_cast<off_t>(used)) != 0)
+      fprintf(stderr, "FileLogSink: truncating %s: %s\n", path.c_str(),
+              strerror(errno));
+    close(fd);
+  }
+}
+
+FileLogSink::FileLogSink(const FileLogSinkOptions& options)
+    : options_(options) {}
+
+FileLogSink::~FileLogSink() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> _(sync_mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  std::vector<std::shared_ptr<Mapping>> mappings;
+  std::shared_ptr<Mapping> spare;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    mappings.swap(retired_);
+    if (current_)
+      mappings.push_back(std::move(current_));
+    spare = std::move(spare_);
+  }
+  // Never written to.
+  if (spare)
+    unlink(spare->path.c_str());
+  std::lock_guard<std::mutex> _(sync_mutex_);
+  for (auto& mapping : mappings)
+    SyncMapping(mapping.get());
+}
+
+bool FileLogSink::Init() {
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    if (current_)
+      return true;
+  }
+  Prepare();
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    if (!Rotate())
+      return false;
+  }
+  // And the one after.
+  Prepare();
+  thread_ = std::thread(&FileLogSink::Run, this);
+  return true;
+}
+
+void FileLogSink::Sync() {
+  std::shared_ptr<Mapping> mapping;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    mapping = current_;
+  }
+  if (mapping) {
+    std::lock_guard<std::mutex> _(sync_mutex_);
+    SyncMapping(mapping.get());
+  }
+}
+
+void FileLogSink::OnLogMessage(const std::string& message) {
+  std::lock_guard<std::mutex> _(mutex_);
+  if (!current_)
+    return;
+  size_t size = std::min(message.size(), options_.file_size);
+  if (current_->used + size > current_->size && !Rotate()) {
+    dropped_++;
+    return;
+  }
+
+  Mapping* mapping = current_.get();
+  memcpy(mapping->data + mapping->used, message.data(), size);
+  mapping->used += size;
+}
+
+std::string FileLogSink::CurrentPath() {
+  std::lock_guard<std::mutex> _(mutex_);
+  return current_ ? current_->path : std::string();
+}
+
+bool FileLogSink::Rotate() {
+  if (!spare_)
+    return false;
+
+  if (current_)
+    retired_.push_back(std::move(current_));
+  current_ = std::move(spare_);
+  current_->opened_at = time(nullptr);
+  if (dropped_ > 0) {
+    fprintf(stderr, "FileLogSink: %llu lines dropped before %s\n",
+            static_cast<unsigned long long>(dropped_), current_->path.c_str());
+    dropped_ = 0;
+  }
+
+  files_.push_back(current_->path);
+  while (options_.max_files > 0 &&
+         files_.size() > static_cast<size_t>(options_.max_files)) {
+    // Still mapped if not finished yet, the pages go with the last close.
+    unlink(files_.front().c_str());
+    files_.pop_front();
+  }
+  // To finish the old file and open the next one.
+  wake_.notify_one();
+  return true;
+}
+
+void FileLogSink::Prepare() {
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    if (spare_)
+      return;
+  }
+  const int64_t now_ms = NowMs();
+  if (now_ms < retry_at_ms_)
+    return;
+
+  // Open and preallocate outside |mutex_|, the loggers keep going.
+  std::shared_ptr<Mapping> mapping = Open();
+  if (!mapping) {
+    retry_delay_ms_ = retry_delay_ms_ == 0
+                          ? kMinRetryMs
+                          : std::min(retry_delay_ms_ * 2, kMaxRetryMs);
+    retry_at_ms_ = now_ms + retry_delay_ms_;
+    return;
+  }
+  retry_delay_ms_ = 0;
+  std::lock_guard<std::mutex> _(mutex_);
+  spare_ = std::move(mapping);
+}
+
+std::shared_ptr<FileLogSink::Mapping> FileLogSink::Open() {
+  const time_t now = time(nullptr);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  char name[64];
+  snprintf(name, sizeof(name), "-%04d%02d%02d-%02d%02d%02d.%d.log",
+           tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+           tm.tm_min, tm.tm_sec, sequence_++);
+
+  auto mapping = std::make_shared<Mapping>();
+  mapping->path = options_.directory + "/" + options_.prefix + name;
+  mapping->size = options_.file_size;
+
+  int err = -1;
+  do {
+    mapping->fd = open(mapping->path.c_str(),
+                       O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (mapping->fd < 0)
+      break;
+    if (!Preallocate(mapping->fd, mapping->size))
+      break;
+    void* data = mmap(nullptr, mapping->size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, mapping->fd, 0);
+    if (data == MAP_FAILED)
+      break;
+    mapping->data = static_cast<char*>(data);
+    err = 0;
+  } while (0);
+
+  if (err != 0) {
+    fprintf(stderr, "FileLogSink: opening %s: %s\n", mapping->path.c_str(),
+            strerror(errno));
+    if (mapping->fd >= 0)
+      unlink(mapping->path.c_str());
+    return nullptr;
+  }
+  return mapping;
+}
+
+// Called with |sync_mutex_| held, which guards |synced|.
+void FileLogSink::SyncMapping(Mapping* mapping) {
+  size_t used;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    used = mapping->used;
+  }
+  if (used <= mapping->synced)
+    return;
+
+  const size_t start = mapping->synced & ~(PageSize() - 1);
+  if (msync(mapping->data + start, used - start, MS_SYNC) != 0) {
+    fprintf(stderr, "FileLogSink: syncing %s: %s\n", mapping->path.c_str(),
+            strerror(errno));
+    return;
+  }
+  mapping->synced = used;
+}
+
+void FileLogSink::Run() {
+  SetCurrentThreadName("log-file-sync");
+
+  std::unique_lock<std::mutex> lock(sync_mutex_);
+  while (!stopping_) {
+    wake_.wait_for(lock, std::chrono::milliseconds(options_.sync_period_ms));
+
+    std::shared_ptr<Mapping> current;
+    std::vector<std::shared_ptr<Mapping>> retired;
+    {
+      std::lock_guard<std::mutex> _(mutex_);
+      // Retried next round if the next file isn't there yet.
+      if (options_.rotate_seconds > 0 && current_ && current_->used > 0 &&
+          time(nullptr) - current_->opened_at >= options_.rotate_seconds)
+        Rotate();
+      current = current_;
+      retired.swap(retired_);
+    }
+
+    // The last references to rotated files go here, off the logging path.
+    for (auto& mapping : retired)
+      SyncMapping(mapping.get());
+    retired.clear();
+    if (current)
+      SyncMapping(current.get());
+
+    Prepare();
+  }
+}
+
+bool FileLogSink::Repair(const std::string& path) {
+  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  int err = -1;
+  do {
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+      break;
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+      err = 0;
+      break;
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+      break;
+    const char* begin = static_cast<const char*>(data);
+    const char* end = static_cast<const char*>(memchr(begin, '\0', size));
+    if (end == nullptr)
+      end = begin + size;
+    // Back to the end of the last complete line.
+    while (end > begin && end[-1] != '\n')
+      end--;
+    const off_t length = end - begin;
+    munmap(data, size);
+    if (ftruncate(fd, length) != 0)
+      break;
+    err = 0;
+  } while (0);
+
+  close(fd);
+  return err == 0;
+}
+
+}  // namespace tuya
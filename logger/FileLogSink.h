@@ -0,0 +1,119 @@
+#ifndef __FILE_LOG_SINK_H__
+#define __FILE_LOG_SINK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Logging.h"
+
+namespace tuya {
+
+struct FileLogSinkOptions {
+  // Directory the files go to, it must exist.
+  std::string directory = ".";
+  // Files are named <prefix>-YYYYMMDD-HHMMSS.<n>.log.
+  std::string prefix = "ndcp";
+  // A file is preallocated to this size and rotated when full.
+  size_t file_size = 64 * 1024 * 1024;
+  // A file is also rotated when it gets this old, 0 for never.
+  int rotate_seconds = 3600;
+  // Oldest files this sink wrote are deleted beyond that many, 0 keeps all.
+  int max_files = 8;
+  // How often the written part of the current file is synced to disk.
+  int sync_period_ms = 1000;
+};
+
+// Appends log lines into a memory mapped, preallocated file: a line costs a
+// memcpy under a short lock, no syscall. A background thread syncs the
+// pages written since the last round every sync_period_ms, rotates the file
+// when it gets too old and finishes the files rotated away: syncs them and
+// truncates them to their written size.
+//
+// That thread also keeps the next file opened and preallocated ahead of
+// time, so rotating a full file is a pointer swap under the lock. Lines that
+// find the current file full before the next one is ready are dropped, and
+// after a failed open the thread waits longer before each new attempt.
+//
+// The unwritten tail of a preallocated file is zeros, and lines are
+// copied whole, in order. A file left behind by a crash therefore reads as
+// complete lines up to the first NUL byte, possibly followed by one partial
+// line. Repair() truncates such a file to its last complete line.
+class FileLogSink : public LogSink {
+ public:
+  explicit FileLogSink(const FileLogSinkOptions& options);
+  ~FileLogSink() override;
+
+  // Opens the first file and starts the sync thread.
+  bool Init();
+  // Syncs what has been written so far; blocks until it is on disk.
+  void Sync();
+
+  void OnLogMessage(const std::string& message) override;
+
+  // Path of the file being written.
+  std::string CurrentPath();
+
+  // Truncates a file left by a crashed process to its last complete line.
+  static bool Repair(const std::string& path);
+
+ private:
+  // One mapped file, unmapped, truncated to |used| and closed when the last
+  // reference goes.
+  struct Mapping {
+    ~Mapping();
+
+    std::string path;
+    int fd = -1;
+    char* data = nullptr;
+    size_t size = 0;
+    // Bytes written, and bytes of those synced already.
+    size_t used = 0;
+    size_t synced = 0;
+    int64_t opened_at = 0;
+  };
+
+  // Makes |spare_| current, false if there is none. Called with |mutex_|
+  // held.
+  bool Rotate();
+  // Opens the spare file if missing and not backing off. Called with
+  // |sync_mutex_| held, or before the sync thread starts.
+  void Prepare();
+  std::shared_ptr<Mapping> Open();
+  void SyncMapping(Mapping* mapping);
+  void Run();
+
+  const FileLogSinkOptions options_;
+
+  std::mutex mutex_;
+  std::shared_ptr<Mapping> current_;
+  // Next file, opened by the sync thread.
+  std::shared_ptr<Mapping> spare_;
+  // Lines dropped while waiting for |spare_|.
+  uint64_t dropped_ = 0;
+  // Files rotated away, finished by the sync thread.
+  std::vector<std::shared_ptr<Mapping>> retired_;
+  std::deque<std::string> files_;
+
+  // Owned by the sync thread.
+  int sequence_ = 0;
+  int64_t retry_at_ms_ = 0;
+  int retry_delay_ms_ = 0;
+
+  std::mutex sync_mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+}  // namespace tuya
+
+#endif  // __FILE_LOG_SINK_H__
@@ -0,0 +1,103 @@
+#include "FlightRecorderSink.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace tuya {
+
+namespace {
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+FlightRecorderSink::FlightRecorderSink(size_t capacity) {
+  size_t count = 2;
+  while (count * kRecordSize < capacity)
+    count <<= 1;
+  records_.reset(new Record[count]);
+  for (size_t i = 0; i < count; i++)
+    records_[i].sequence.store(0, std::memory_order_relaxed);
+  mask_ = count - 1;
+}
+
+FlightRecorderSink::~FlightRecorderSink() = default;
+
+void FlightRecorderSink::OnLogMessage(const std::string& message,
+                                      LoggingSeverity severity) {
+  const uint64_t index = next_.fetch_add(1, std::memory_order_relaxed);
+  Record& record = records_[index & mask_];
+
+  // Readers that see the odd sequence, or see it change while copying,
+  // drop the record.
+  record.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  const size_t length = std::min(message.size(), kMaxLineSize);
+  record.time_us = NowMicros();
+  record.severity = static_cast<uint8_t>(severity);
+  record.length = static_cast<uint16_t>(length);
+  memcpy(record.text, message.data(), length);
+
+  record.sequence.store(index * 2 + 2, std::memory_order_release);
+}
+
+void FlightRecorderSink::OnLogMessage(const std::string& message) {
+  OnLogMessage(message, LS_INFO);
+}
+
+size_t FlightRecorderSink::Dump(LoggingSeverity min_sev,
+                                int64_t since_us,
+                                int64_t until_us,
+                                std::string* out,
+                                size_t max_bytes) const {
+  const uint64_t end = next_.load(std::memory_order_acquire);
+  const uint64_t begin = end > mask_ + 1 ? end - (mask_ + 1) : 0;
+
+  std::string lines;
+  std::vector<size_t> starts;
+  char text[kMaxLineSize];
+  for (uint64_t index = begin; index < end; index++) {
+    const Record& record = records_[index & mask_];
+    const uint64_t sequence = record.sequence.load(std::memory_order_acquire);
+    if (sequence != index * 2 + 2)
+      continue;  // Being written, or already overwritten.
+
+    const int64_t time_us = record.time_us;
+    const LoggingSeverity severity =
+        static_cast<LoggingSeverity>(record.severity);
+    const size_t length = std::min<size_t>(record.length, kMaxLineSize);
+    memcpy(text, record.text, length);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (record.sequence.load(std::memory_order_relaxed) != sequence)
+      continue;
+
+    if (severity < min_sev || time_us < since_us || time_us > until_us)
+      continue;
+    starts.push_back(lines.size());
+    lines.append(text, length);
+    if (length == 0 || text[length - 1] != '\n')
+      lines += '\n';
+  }
+
+  // Keep the newest lines that fit.
+  size_t first = 0;
+  while (first < starts.size() && lines.size() - starts[first] > max_bytes)
+    first++;
+  if (first < starts.size())
+    out->append(lines, starts[first], std::string::npos);
+  return starts.size() - first;
+}
+
+uint64_t FlightRecorderSink::Recorded() const {
+  return next_.load(std::memory_order_relaxed);
+}
+
+}  // namespace tuya
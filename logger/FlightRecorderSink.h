@@ -0,0 +1,76 @@
+#ifndef __FLIGHT_RECORDER_SINK_H__
+#define __FLIGHT_RECORDER_SINK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "Logging.h"
+
+namespace tuya {
+
+// Keeps the most recent log lines in memory, for dumping around an
+// incident. Install it at a lower severity than the other sinks, e.g.
+//   AddLogToStream(&recorder, LS_VERBOSE);
+// to have verbose context at hand without writing it anywhere.
+//
+// Lines go into a ring of fixed-size records; a longer line is cut to
+// kMaxLineSize. Writers claim a record with one atomic increment and
+// publish it seqlock style, so logging never waits for a reader or another
+// writer. Dump() skips the records that are being overwritten while it
+// copies them.
+class FlightRecorderSink : public LogSink {
+ public:
+  static constexpr size_t kRecordSize = 512;
+
+  // Keeps about |capacity| bytes worth of records.
+  explicit FlightRecorderSink(size_t capacity = 16 * 1024 * 1024);
+  ~FlightRecorderSink() override;
+
+  FlightRecorderSink(const FlightRecorderSink&) = delete;
+  FlightRecorderSink& operator=(const FlightRecorderSink&) = delete;
+
+  void OnLogMessage(const std::string& message,
+                    LoggingSeverity severity) override;
+  void OnLogMessage(const std::string& message) override;
+
+  // Appends to |out|, oldest first, the lines still held of |min_sev| and
+  // above logged between |since_us| and |until_us| (microseconds since the
+  // epoch, inclusive), at most |max_bytes| of them, the newest kept.
+  // Returns the number of lines.
+  size_t Dump(LoggingSeverity min_sev,
+              int64_t since_us,
+              int64_t until_us,
+              std::string* out,
+              size_t max_bytes = SIZE_MAX) const;
+
+  // Lines recorded since construction, including the overwritten ones.
+  uint64_t Recorded() const;
+  size_t Capacity() const { return mask_ + 1; }
+
+ private:
+  struct Record {
+    // 2 * index + 1 while being written, 2 * index + 2 once complete.
+    std::atomic<uint64_t> sequence;
+    int64_t time_us;
+    uint16_t length;
+    uint8_t severity;
+    char text[kRecordSize - 19];
+  };
+  static_assert(sizeof(Record) == kRecordSize, "Record padding");
+
+ public:
+  static constexpr size_t kMaxLineSize = sizeof(Record::text);
+
+ private:
+  std::unique_ptr<Record[]> records_;
+  size_t mask_;
+  alignas(64) std::atomic<uint64_t> next_{0};
+};
+
+}  // namespace tuya
+
+#endif  // __FLIGHT_RECORDER_SINK_H__
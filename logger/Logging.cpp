@@ -9,6 +9,8 @@
  */
 
 #include "Logging.h"
+#include "AsyncLogWriter.h"
+#include "BinaryLog.h"
 #include "ThreadTypes.h"
 
 #include <string.h>
@@ -56,6 +58,7 @@ static const int kMaxLogLineSize = 1024 - 60;
 #include <time.h>
 
 #include <algorithm>
+#include <thread>
 #include <cstdarg>
 #include <vector>
 
@@ -81,11 +84,213 @@ const char* FilenameFromPath(const char* file) {
     return (end1 > end2) ? end1 + 1 : end2 + 1;
 }
 
-// Global lock for log subsystem, only needed to serialize access to streams_.
+// Size of "YYYY-MM-DD HH:MM:SS:mmm" and its terminating NUL.
+static constexpr size_t kTimestampSize = 24;
+
+// Writes |value| as |width| zero padded decimal digits, returns the end.
+static char* PutDigits(char* p, int value, int width) {
+  for (int i = width - 1; i >= 0; i--) {
+    p[i] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  }
+  return p + width;
+}
+
+// Formats the current local time into |buf|. The date and time up to the
+// second are formatted once a second per thread, only the milliseconds are
+// patched in for every line. On Linux the clock is CLOCK_REALTIME_COARSE,
+// read from the vDSO without a syscall; its resolution is a scheduler tick
+// (1-4 ms), which is fine for log lines.
+static void FormatTimestamp(char* buf) {
+  int64_t second;
+  int ms;
+#if defined(__LINUX__) || defined(__ANDROID__)
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  second = ts.tv_sec;
+  ms = static_cast<int>(ts.tv_nsec / 1000000);
+#elif defined(WIN)
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  second = ts.tv_sec;
+  ms = static_cast<int>(ts.tv_nsec / 1000000);
+#else
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  second = tv.tv_sec;
+  ms = static_cast<int>(tv.tv_usec / 1000);
+#endif
+
+  // "YYYY-MM-DD HH:MM:SS:" of the last second this thread formatted.
+  static thread_local int64_t cached_second = -1;
+  static thread_local char cached_prefix[kTimestampSize - 4];
+  if (second != cached_second) {
+    const time_t now = static_cast<time_t>(second);
+    struct tm tm;
+#if defined(WIN)
+    localtime_s(&tm, &now);
+#else
+    localtime_r(&now, &tm);
+#endif
+    // By hand: every field has a fixed width, which snprintf can't be told
+    // about, and the year is kept to four digits.
+    char* p = cached_prefix;
+    p = PutDigits(p, std::min(std::max(tm.tm_year + 1900, 0), 9999), 4);
+    *p++ = '-';
+    p = PutDigits(p, tm.tm_mon + 1, 2);
+    *p++ = '-';
+    p = PutDigits(p, tm.tm_mday, 2);
+    *p++ = ' ';
+    p = PutDigits(p, tm.tm_hour, 2);
+    *p++ = ':';
+    p = PutDigits(p, tm.tm_min, 2);
+    *p++ = ':';
+    p = PutDigits(p, tm.tm_sec, 2);
+    *p++ = ':';
+    cached_second = second;
+  }
+
+  memcpy(buf, cached_prefix, sizeof(cached_prefix));
+  PutDigits(buf + sizeof(cached_prefix), ms, 3);
+  buf[kTimestampSize - 1] = '\0';
+}
+
+// Global lock for log subsystem, only needed to serialize changes to
+// streams_. Logging threads read the published SinkSnapshot instead.
 // TODO(bugs.webrtc.org/11665): this is not currently constant initialized and
 // trivially destructible.
 std::mutex g_log_mutex_;
 
+// Immutable copy of streams_ the logging threads iterate without a lock.
+struct SinkSnapshot {
+  std::vector<std::pair<LogSink*, LoggingSeverity>> sinks;
+};
+
+// Epoch based reclamation for SinkSnapshot. A reader counts itself in on
+// the current epoch's counter before loading the snapshot and out when done
+// with it. A writer publishes the new snapshot, flips the epoch and waits
+// for the old epoch's readers to leave. A reader only keeps its count once
+// it has seen the epoch unchanged after counting in, so it is either waited
+// for or loads the snapshot after the flip, which is the new one. The counters are striped over cache lines
+// so threads that log concurrently don't share one.
+class SinkReaders {
+ public:
+  // Returns the token to pass to Leave().
+  int Enter() {
+    static std::atomic<int> next_stripe = {0};
+    static thread_local int stripe =
+        next_stripe.fetch_add(1, std::memory_order_relaxed) % kStripes;
+    int epoch = epoch_.load(std::memory_order_seq_cst);
+    for (;;) {
+      counters_[epoch][stripe].readers.fetch_add(1, std::memory_order_seq_cst);
+      // A writer may have flipped the epoch and found this counter at zero
+      // before we got in, and would not wait for us. Count in again on the
+      // epoch it flipped to.
+      const int current = epoch_.load(std::memory_order_seq_cst);
+      if (current == epoch)
+        break;
+      counters_[epoch][stripe].readers.fetch_sub(1, std::memory_order_release);
+      epoch = current;
+    }
+    return epoch * kStripes + stripe;
+  }
+
+  void Leave(int token) {
+    counters_[token / kStripes][token % kStripes].readers.fetch_sub(
+        1, std::memory_order_release);
+  }
+
+  // Called with g_log_mutex_ held, after the new snapshot is published.
+  // Must not be called from a sink, it would wait for itself.
+  void Synchronize() {
+    const int old_epoch = epoch_.load(std::memory_order_relaxed);
+    epoch_.store(old_epoch ^ 1, std::memory_order_seq_cst);
+    for (int stripe = 0; stripe < kStripes; stripe++) {
+      while (counters_[old_epoch][stripe].readers.load(
+                 std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+    }
+  }
+
+ private:
+  static constexpr int kStripes = 64;
+  struct alignas(64) Counter {
+    std::atomic<int> readers = {0};
+  };
+
+  Counter counters_[2][kStripes];
+  std::atomic<int> epoch_ = {0};
+};
+
+SinkReaders g_sink_readers_;
+std::atomic<const SinkSnapshot*> g_sink_snapshot_ = {nullptr};
+
+// Per-file levels set by SetVModule(), first match wins.
+struct VModuleEntry {
+  std::string glob;
+  bool match_path;
+  LoggingSeverity level;
+};
+std::mutex g_vmodule_mutex_;
+std::vector<VModuleEntry> g_vmodule_;
+std::atomic<bool> g_vmodule_empty_ = {true};
+
+namespace {
+
+// Matches |name| against a glob of '*' and '?'.
+bool GlobMatch(const char* glob, const char* name, size_t len) {
+  const char* star = nullptr;
+  size_t star_pos = 0;
+  size_t i = 0;
+  while (i < len) {
+    if (*glob == '?' || (*glob != '\0' && *glob != '*' && *glob == name[i])) {
+      glob++;
+      i++;
+    } else if (*glob == '*') {
+      star = ++glob;
+      star_pos = i;
+    } else if (star) {
+      glob = star;
+      i = ++star_pos;
+    } else {
+      return false;
+    }
+  }
+  while (*glob == '*')
+    glob++;
+  return *glob == '\0';
+}
+
+bool ParseSeverity(const std::string& name, LoggingSeverity* sev) {
+  static const char* const kNames[] = {"verbose", "info", "warning", "error",
+                                       "none"};
+  for (int i = LS_VERBOSE; i <= LS_NONE; i++) {
+    if (name == kNames[i] || name == std::to_string(i)) {
+      *sev = static_cast<LoggingSeverity>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Level of the first entry matching |file|, -1 if none does.
+int MatchVModule(const char* file) {
+  const char* name = FilenameFromPath(file);
+  const char* dot = strrchr(name, '.');
+  const size_t name_len = dot ? dot - name : strlen(name);
+  const size_t path_len = name - file + name_len;
+
+  std::lock_guard<std::mutex> _(g_vmodule_mutex_);
+  for (const VModuleEntry& entry : g_vmodule_) {
+    if (entry.match_path ? GlobMatch(entry.glob.c_str(), file, path_len)
+                         : GlobMatch(entry.glob.c_str(), name, name_len))
+      return entry.level;
+  }
+  return -1;
+}
+
+}  // namespace
+
 /////////////////////////////////////////////////////////////////////////////
 // LogMessage
 /////////////////////////////////////////////////////////////////////////////
@@ -98,6 +303,8 @@ bool LogMessage::log_to_stderr_ = true;
 // cleanup by setting to null, or let it leak (safe at program exit).
 LogSink* LogMessage::streams_  = nullptr;
 std::atomic<bool> LogMessage::streams_empty_ = {true};
+std::atomic<bool> LogMessage::async_ = {false};
+std::atomic<uint32_t> LogMessage::generation_ = {1};
 
 // Boolean options default to false (0)
 bool LogMessage::thread_, LogMessage::timestamp_;
@@ -110,41 +317,59 @@ LogMessage::LogMessage(const char* file,
                        LoggingSeverity sev,
                        LogErrorContext err_ctx,
                        int err)
+    : LogMessage(file,
+                 file != nullptr ? FilenameFromPath(file) : nullptr,
+                 line,
+                 sev,
+                 err_ctx,
+                 err) {}
+
+LogMessage::LogMessage(const LogMetadata& meta, const char* basename)
+    : LogMessage(meta.File(),
+                 basename,
+                 meta.Line(),
+                 meta.Severity(),
+                 ERRCTX_NONE,
+                 0) {}
+
+LogMessage::LogMessage(const LogMetadataErr& meta, const char* basename)
+    : LogMessage(meta.meta.File(),
+                 basename,
+                 meta.meta.Line(),
+                 meta.meta.Severity(),
+                 meta.err_ctx,
+                 meta.err) {}
+
+LogMessage::LogMessage(const char* file,
+                       const char* basename,
+                       int line,
+                       LoggingSeverity sev,
+                       LogErrorContext err_ctx,
+                       int err)
     : severity_(sev) {
   if (timestamp_) {
-	struct tm tm;
-    struct timeval tv;
-#if defined(__APPLE__)
-    int64_t time = SystemTimeMillis();
-    int second = time/1000;
-    int ms = time % 1000;
-    tv.tv_usec = ms;
-    gmtime_r((const time_t *)(&second), &tm);
-#elif defined(WIN)
-    time_t now = time(nullptr);
-    tm = *localtime(&now);
-    #else
-      gettimeofday(&tv, NULL);
-      localtime_r(&tv.tv_sec, &tm);
-    #endif
-    char timestamp[50];  // Maximum string length of an int64_t is 20.
-    int len = snprintf(timestamp, sizeof(timestamp), "%4d-%02d-%02d %02d:%02d:%02d:%03d",
-    		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-			tm.tm_hour, tm.tm_min, tm.tm_sec, tv.tv_usec/1000);
+    char timestamp[kTimestampSize];
+    FormatTimestamp(timestamp);
     print_stream_ << timestamp;
   }
 
   if (thread_) {
-    PlatformThreadId id = CurrentThreadId();
-    print_stream_ << "[" << id << "] ";
+    // The name if the thread has one, else its id.
+    const char* name = CurrentThreadName();
+    if (*name != '\0')
+      print_stream_ << "[" << name << "] ";
+    else
+      print_stream_ << "[" << CurrentThreadId() << "] ";
   }
 
   if (file != nullptr) {
+    LoggingSeverity level;
+    forced_ = GetVModuleLevel(file, &level) && sev >= level;
 #if defined(__ANDROID__)
-    tag_ = FilenameFromPath(file);
+    tag_ = basename;
     print_stream_ << "(line " << line << "): ";
 #else
-    print_stream_ << "(" << FilenameFromPath(file) << ":" << line << "): ";
+    print_stream_ << "(" << basename << ":" << line << "): ";
 #endif
   }
 
@@ -181,7 +406,7 @@ LogMessage::LogMessage(const char* file,
   }
 }
 
-#if defined(WEBRTC_ANDROID)
+#if defined(__ANDROID__)
 LogMessage::LogMessage(const char* file,
                        int line,
                        LoggingSeverity sev,
@@ -190,32 +415,62 @@ LogMessage::LogMessage(const char* file,
   tag_ = tag;
   print_stream_ << tag << ": ";
 }
+
+LogMessage::LogMessage(const LogMetadata& meta,
+                       const char* basename,
+                       const char* tag)
+    : LogMessage(meta, basename) {
+  tag_ = tag;
+  print_stream_ << tag << ": ";
+}
 #endif
 
 
 LogMessage::~LogMessage() {
   FinishPrintStream();
-  
-  //std::string str = std::move(print_stream_.str());
 
-  if (severity_ >= g_dbg_sev) {
-#if defined(WEBRTC_ANDROID)
-    OutputToDebug(print_stream_.str(), severity_, tag_);
+#if defined(__ANDROID__)
+  const char* tag = tag_;
 #else
-    OutputToDebug(print_stream_.str(), severity_);
+  const char* tag = nullptr;
 #endif
+  if (async_.load(std::memory_order_relaxed) &&
+      AsyncLogWriter::Instance().Enqueue(severity_, tag, forced_,
+                                         print_stream_.str())) {
+    return;
   }
+  Dispatch(print_stream_.str(), severity_, tag, forced_);
+}
 
-  std::lock_guard<std::mutex> _(g_log_mutex_);
-  for (LogSink* entry = streams_; entry != nullptr; entry = entry->next_) {
-    if (severity_ >= entry->min_severity_) {
-#if defined(WEBRTC_ANDROID)
-      entry->OnLogMessage(str, severity_, tag_);
+void LogMessage::Dispatch(const std::string& str,
+                          LoggingSeverity severity,
+                          [[maybe_unused]] const char* tag,
+                          bool forced) {
+  if (forced || severity >= g_dbg_sev) {
+#if defined(__ANDROID__)
+    OutputToDebug(str, severity, tag);
+#else
+    OutputToDebug(str, severity);
+#endif
+  }
+
+  if (streams_empty_.load(std::memory_order_relaxed))
+    return;
+  const int token = g_sink_readers_.Enter();
+  const SinkSnapshot* snapshot =
+      g_sink_snapshot_.load(std::memory_order_seq_cst);
+  if (snapshot != nullptr) {
+    for (const auto& entry : snapshot->sinks) {
+      if (forced || severity >= entry.second) {
+#if defined(__ANDROID__)
+        entry.first->OnLogMessage(str, severity, tag);
 #else
-      entry->OnLogMessage(print_stream_.str(), severity_);
+        entry.first->OnLogMessage(str, severity);
 #endif
+      }
     }
   }
+  g_sink_readers_.Leave(token);
 }
 
 void LogMessage::AddTag(const char* tag) {
@@ -286,10 +541,29 @@ void LogMessage::AddLogToStream(LogSink* stream, LoggingSeverity min_sev) {
   stream->min_severity_ = min_sev;
   stream->next_ = streams_;
   streams_ = stream;
+  PublishSinks();
   streams_empty_.store(false, std::memory_order_relaxed);
   UpdateMinLogSeverity();
 }
 
+void LogMessage::StartAsyncLogging(const AsyncLoggingOptions& options) {
+  AsyncLogWriter::Instance().Start(options);
+  async_.store(true, std::memory_order_relaxed);
+}
+
+void LogMessage::StopAsyncLogging() {
+  async_.store(false, std::memory_order_relaxed);
+  AsyncLogWriter::Instance().Stop();
+}
+
+void LogMessage::Flush() {
+  AsyncLogWriter::Instance().Flush();
+}
+
+AsyncLoggingStats LogMessage::GetAsyncLoggingStats() {
+  return AsyncLogWriter::Instance().GetStats();
+}
+
 void LogMessage::RemoveLogToStream(LogSink* stream) {
   std::lock_guard<std::mutex> _(g_log_mutex_);
   for (LogSink** entry = &streams_; *entry != nullptr;
@@ -300,15 +574,177 @@ void LogMessage::RemoveLogToStream(LogSink* stream) {
     }
   }
   streams_empty_.store(streams_ == nullptr, std::memory_order_relaxed);
+  PublishSinks();
   UpdateMinLogSeverity();
 }
 
+void LogMessage::PublishSinks() {
+  SinkSnapshot* snapshot = nullptr;
+  if (streams_ != nullptr) {
+    snapshot = new SinkSnapshot;
+    for (LogSink* entry = streams_; entry != nullptr; entry = entry->next_)
+      snapshot->sinks.emplace_back(entry, entry->min_severity_);
+  }
+  const SinkSnapshot* old =
+      g_sink_snapshot_.exchange(snapshot, std::memory_order_seq_cst);
+  // Once no reader can still hold |old|, a removed sink gets no more calls.
+  g_sink_readers_.Synchronize();
+  delete old;
+}
+
 void LogMessage::UpdateMinLogSeverity() {
   LoggingSeverity min_sev = g_dbg_sev;
   for (LogSink* entry = streams_; entry != nullptr; entry = entry->next_) {
     min_sev = std::min(min_sev, entry->min_severity_);
   }
   g_min_sev = min_sev;
+  BumpGeneration();
+}
+
+void LogMessage::BumpGeneration() {
+  generation_.fetch_add(1, std::memory_order_release);
+}
+
+void LogMessage::ConfigureLogging(const char* params) {
+  LoggingSeverity current_level = LS_VERBOSE;
+  LoggingSeverity debug_level = GetLogToDebug();
+
+  const char* token = params;
+  while (*token != '\0') {
+    const char* end = strchr(token, ' ');
+    const std::string word(token, end ? end - token : strlen(token));
+    token += word.size();
+    while (*token == ' ')
+      token++;
+
+    // Logging features
+    if (word == "tstamp") {
+      LogTimestamps();
+    } else if (word == "thread") {
+      LogThreads();
+    } else if (word.compare(0, 8, "vmodule=") == 0) {
+      SetVModule(word.c_str() + 8);
+    } else if (ParseSeverity(word, &current_level)) {
+      // Logging levels, taken by the targets that follow.
+    } else if (word == "debug") {
+      // Logging targets
+      debug_level = current_level;
+    }
+  }
+  LogToDebug(debug_level);
+}
+
+void LogMessage::SetVModule(const char* spec) {
+  std::vector<VModuleEntry> entries;
+  const char* item = spec;
+  while (*item != '\0') {
+    const char* end = strchr(item, ',');
+    const std::string pair(item, end ? end - item : strlen(item));
+    item += pair.size();
+    if (*item == ',')
+      item++;
+
+    const size_t eq = pair.rfind('=');
+    LoggingSeverity level;
+    if (eq == std::string::npos || eq == 0 ||
+        !ParseSeverity(pair.substr(eq + 1), &level))
+      continue;
+    VModuleEntry entry;
+    entry.glob = pair.substr(0, eq);
+    entry.match_path = entry.glob.find('/') != std::string::npos;
+    entry.level = level;
+    entries.push_back(std::move(entry));
+  }
+
+  {
+    std::lock_guard<std::mutex> _(g_vmodule_mutex_);
+    g_vmodule_.swap(entries);
+    g_vmodule_empty_.store(g_vmodule_.empty(), std::memory_order_relaxed);
+  }
+  BumpGeneration();
+}
+
+bool LogMessage::GetVModuleLevel(const char* file, LoggingSeverity* level) {
+  if (g_vmodule_empty_.load(std::memory_order_relaxed))
+    return false;
+
+  // Matching takes a lock and a glob per entry, so each thread remembers the
+  // result for the files it logged from last.
+  struct CacheEntry {
+    const char* file;
+    uint32_t generation;
+    int level;
+  };
+  static thread_local CacheEntry cache[16];
+  const uint32_t generation = generation_.load(std::memory_order_acquire);
+  CacheEntry& entry = cache[(reinterpret_cast<uintptr_t>(file) >> 4) & 15];
+  if (entry.file != file || entry.generation != generation) {
+    entry.file = file;
+    entry.generation = generation;
+    entry.level = MatchVModule(file);
+  }
+  if (entry.level < 0)
+    return false;
+  *level = static_cast<LoggingSeverity>(entry.level);
+  return true;
+}
+
+bool LogCallSite::Update(const char* file, LoggingSeverity sev) {
+  // Read before the levels: if they change meanwhile the flag is stored
+  // with a generation that is already stale and gets computed again.
+  const uint32_t generation =
+      LogMessage::generation_.load(std::memory_order_acquire);
+  LoggingSeverity level;
+  const bool on = LogMessage::GetVModuleLevel(file, &level)
+                      ? sev >= level
+                      : sev >= g_min_sev;
+  state_.store(generation << 1 | (on ? 1 : 0), std::memory_order_relaxed);
+  return on;
+}
+
+int64_t LogLimiter::EveryN(uint32_t n) {
+  const uint64_t count = count_.fetch_add(1, std::memory_order_relaxed);
+  if (n <= 1)
+    return 0;
+  if (count % n != 0)
+    return -1;
+  return count == 0 ? 0 : n - 1;
+}
+
+int64_t LogLimiter::FirstN(uint32_t n) {
+  // Past the limit the counter is only read, so a storm doesn't keep
+  // bouncing its cache line between threads.
+  if (count_.load(std::memory_order_relaxed) >= n)
+    return -1;
+  return count_.fetch_add(1, std::memory_order_relaxed) < n ? 0 : -1;
+}
+
+int64_t LogLimiter::EveryT(int64_t period_ns) {
+  const int64_t now = LogMessage::SystemTimeNanos();
+  int64_t next = next_ns_.load(std::memory_order_relaxed);
+  // Only the thread that moves the deadline forward prints.
+  if (now < next || !next_ns_.compare_exchange_strong(
+                        next, now + period_ns, std::memory_order_relaxed)) {
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return -1;
+  }
+  return suppressed_.exchange(0, std::memory_order_relaxed);
+}
+
+int64_t LogLimiter::Sampled(uint32_t one_in) {
+  // xorshift64, one state per thread.
+  static thread_local uint64_t state = 0;
+  if (state == 0)
+    state = (reinterpret_cast<uintptr_t>(&state) ^
+             static_cast<uint64_t>(LogMessage::SystemTimeNanos())) | 1;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  if (one_in > 1 && state % one_in != 0) {
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return -1;
+  }
+  return suppressed_.exchange(0, std::memory_order_relaxed);
 }
 
 #if defined(__ANDROID__)
@@ -479,15 +915,81 @@ int64_t LogMessage::SystemTimeNanos() {
   return ticks;
 }
 
-std::string ToHex(const int i) {
-  char buffer[50];
-  snprintf(buffer, sizeof(buffer), "%x", i);
+namespace {
 
-  return std::string(buffer);
+// Streams the arguments described by |fmt|, up to kEnd. Returns false on an
+// argument type it doesn't know.
+template <typename Stream>
+bool AppendArgs(Stream& stream, const LogArgType* fmt, va_list* args) {
+  for (; *fmt != LogArgType::kEnd; ++fmt) {
+    switch (*fmt) {
+      case LogArgType::kInt:
+        stream << va_arg(*args, int);
+        break;
+      case LogArgType::kLong:
+        stream << va_arg(*args, long);
+        break;
+      case LogArgType::kLongLong:
+        stream << va_arg(*args, long long);
+        break;
+      case LogArgType::kUInt:
+        stream << va_arg(*args, unsigned);
+        break;
+      case LogArgType::kULong:
+        stream << va_arg(*args, unsigned long);
+        break;
+      case LogArgType::kULongLong:
+        stream << va_arg(*args, unsigned long long);
+        break;
+      case LogArgType::kDouble:
+        stream << va_arg(*args, double);
+        break;
+      case LogArgType::kLongDouble:
+        stream << va_arg(*args, long double);
+        break;
+      case LogArgType::kCharP: {
+        const char* s = va_arg(*args, const char*);
+        stream << (s ? s : "(null)");
+        break;
+      }
+      case LogArgType::kStdString:
+        stream << *va_arg(*args, const std::string*);
+        break;
+      case LogArgType::kVoidP:
+        stream << va_arg(*args, const void*);
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
 }
+
+// Site IDs of Log() call sites, which have no static of their own. A small
+// per-thread direct-mapped cache in front of BinaryLog::RegisterSite().
+uint32_t BinarySite(const LogMetadata& meta) {
+  struct Entry {
+    const char* file;
+    int line;
+    uint32_t site;
+  };
+  static thread_local Entry cache[64];
+  const uintptr_t hash =
+      (reinterpret_cast<uintptr_t>(meta.File()) >> 3) ^ meta.Line();
+  Entry& entry = cache[hash % 64];
+  if (entry.file != meta.File() || entry.line != meta.Line()) {
+    entry.site = BinaryLog::RegisterSite(meta.File(), meta.Line(),
+                                         meta.Severity());
+    entry.file = meta.File();
+    entry.line = meta.Line();
+  }
+  return entry.site;
+}
+
+}  // namespace
+
 void Log(const LogArgType* fmt, ...) {
   va_list args;
-  printf("%s %s %d\n", __FILE__, __FUNCTION__, __LINE__);
   va_start(args, fmt);
 
   LogMetadataErr meta;
@@ -515,55 +1017,22 @@ void Log(const LogArgType* fmt, ...) {
     }
   }
 
+  // Binary mode: raw arguments, formatted later by the decoder.
+  if (meta.meta.File() != nullptr && BinaryLog::IsOn(meta.meta.Severity())) {
+    BinaryLogLine line(BinarySite(meta.meta));
+    AppendArgs(line, fmt + 1, &args);
+    if (meta.err_ctx == ERRCTX_ERRNO)
+      line << BINLOG_LIT(" : [errno ") << meta.err << BINLOG_LIT("]");
+    va_end(args);
+    return;
+  }
+
   LogMessage logMessage(meta.meta.File(), meta.meta.Line(),
                          meta.meta.Severity(), meta.err_ctx, meta.err);
   if (tag) {
     logMessage.AddTag(tag);
   }
-
-  for (++fmt; *fmt != LogArgType::kEnd; ++fmt) {
-    switch (*fmt) {
-      case LogArgType::kInt:
-        logMessage.stream() << va_arg(args, int);
-        break;
-      case LogArgType::kLong:
-        logMessage.stream() << va_arg(args, long);
-        break;
-      case LogArgType::kLongLong:
-        logMessage.stream() << va_arg(args, long long);
-        break;
-      case LogArgType::kUInt:
-        logMessage.stream() << va_arg(args, unsigned);
-        break;
-      case LogArgType::kULong:
-        logMessage.stream() << va_arg(args, unsigned long);
-        break;
-      case LogArgType::kULongLong:
-        logMessage.stream() << va_arg(args, unsigned long long);
-        break;
-      case LogArgType::kDouble:
-        logMessage.stream() << va_arg(args, double);
-        break;
-      case LogArgType::kLongDouble:
-        logMessage.stream() << va_arg(args, long double);
-        break;
-      case LogArgType::kCharP: {
-        const char* s = va_arg(args, const char*);
-        logMessage.stream() << (s ? s : "(null)");
-        break;
-      }
-      case LogArgType::kStdString:
-        logMessage.stream() << *va_arg(args, const std::string*);
-        break;
-      case LogArgType::kVoidP:
-        logMessage.stream() << ToHex(
-            reinterpret_cast<uintptr_t>(va_arg(args, const void*)));
-        break;
-      default:
-        va_end(args);
-        return;
-    }
-  }
+  AppendArgs(logMessage.stream(), fmt + 1, &args);
 
   va_end(args);
 }
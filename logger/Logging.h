@@ -3,13 +3,16 @@
 #define __LOGGING_H_
 
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include <atomic>
 #include <sstream>
 #include <string>
 #include <utility>
 
-#define USE_STD_STREAM
+// Define USE_STD_STREAM to build log lines with std::ostringstream rather
+// than the allocation-free StringBuilder.
 #ifndef USE_STD_STREAM
 #include "StringBuilder.h"
 #else
@@ -47,8 +50,32 @@ enum LogErrorContext {
   ERRCTX_HR = ERRCTX_HRESULT,  // LOG_E(sev, HR, x)
 };
 
+// What a producer does when the asynchronous log queue is full.
+enum class LogOverflowPolicy {
+  kDrop,   // Drop the record and count it.
+  kBlock,  // Wait for the writer thread to make room, and count the wait.
+};
+
+struct AsyncLoggingOptions {
+  // Records the queue holds, rounded up to a power of two.
+  size_t capacity = 8192;
+  LogOverflowPolicy overflow = LogOverflowPolicy::kDrop;
+};
+
+// Counters since asynchronous logging was started.
+struct AsyncLoggingStats {
+  uint64_t enqueued = 0;
+  uint64_t written = 0;
+  uint64_t dropped = 0;
+  // Records whose producer had to wait for room (kBlock).
+  uint64_t blocked = 0;
+  size_t capacity = 0;
+};
+
 class LogMessage;
-// Virtual sink interface that can receive log messages.
+// Virtual sink interface that can receive log messages. OnLogMessage() is
+// called from the logging threads without a lock, possibly from several
+// threads at once, and must not add or remove sinks.
 class LogSink {
  public:
   LogSink() {}
@@ -72,9 +99,20 @@ class LogSink {
 };
 
 
+// The part of |path| after the last slash. constexpr so the LOGx macros
+// trim __FILE__ at compile time.
+constexpr const char* LogBasename(const char* path) {
+  const char* basename = path;
+  for (const char* p = path; *p != '\0'; ++p) {
+    if (*p == '/' || *p == '\\')
+      basename = p + 1;
+  }
+  return basename;
+}
+
 class LogMetadata {
  public:
-  LogMetadata(const char* file, int line, LoggingSeverity severity)
+  constexpr LogMetadata(const char* file, int line, LoggingSeverity severity)
       : file_(file),
         line_and_sev_(static_cast<uint32_t>(line) << 3 | severity) {}
   LogMetadata() = default;
@@ -154,6 +192,13 @@ class LogMessage {
 #if defined(__ANDROID__)
   LogMessage(const char* file, int line, LoggingSeverity sev, const char* tag);
 #endif
+  // Used by the LOGx macros: |basename| is LogBasename(meta.File()),
+  // computed at compile time, so the header needs no scan of the path.
+  LogMessage(const LogMetadata& meta, const char* basename);
+  LogMessage(const LogMetadataErr& meta, const char* basename);
+#if defined(__ANDROID__)
+  LogMessage(const LogMetadata& meta, const char* basename, const char* tag);
+#endif
 
   ~LogMessage();
 
@@ -189,6 +234,16 @@ class LogMessage {
   // early concurrent log statement happening from another thread happening near
   // this instant.
   static void AddLogToStream(LogSink* stream, LoggingSeverity min_sev);
+  // Async: formatted lines are queued to a writer thread which outputs them
+  // and calls the sinks, so the logging thread never waits on a sink. Until
+  // StopAsyncLogging() returns, sinks are called from that thread only.
+  static void StartAsyncLogging(const AsyncLoggingOptions& options);
+  // Writes out what is queued and goes back to synchronous logging.
+  static void StopAsyncLogging();
+  // Returns once everything logged before the call has been written out.
+  // No-op in synchronous mode.
+  static void Flush();
+  static AsyncLoggingStats GetAsyncLoggingStats();
   // Removes the specified stream, without destroying it. When the method
   // has completed, it's guaranteed that |stream| will receive no more logging
   // calls.
@@ -201,7 +256,26 @@ class LogMessage {
   static int GetMinLogSeverity();
   // Parses the provided parameter stream to configure the options above.
   // Useful for configuring logging from the command line.
+  // Besides the WebRTC tokens ("tstamp thread verbose info warning error none
+  // debug") takes "vmodule=<spec>", see SetVModule().
   static void ConfigureLogging(const char* params);
+  // Sets per-file levels from a comma separated list of glob=level pairs,
+  // e.g. "Http*=verbose,Looper=1". The level is a severity name or its
+  // number. A glob without '/' is matched against the file name without
+  // directory and extension, one with '/' against the path without
+  // extension. The first matching glob wins and its level replaces the
+  // global ones for that file: its lines at or above the level go to the
+  // debug output and to every sink, the others are dropped. An empty spec
+  // clears the list.
+  static void SetVModule(const char* spec);
+  // Returns false if no glob of SetVModule() matches |file|, else sets
+  // |level| to the lowest severity enabled for it.
+  static bool GetVModuleLevel(const char* file, LoggingSeverity* level);
+  // Changes every time the levels above are changed, LogCallSite uses it to
+  // tell when its cached flag is stale.
+  static uint32_t Generation() {
+    return generation_.load(std::memory_order_relaxed);
+  }
   // Checks the current global debug severity and if the |streams_| collection
   // is empty. If |severity| is smaller than the global severity and if the
   // |streams_| collection is empty, the LogMessage will be considered a noop
@@ -217,9 +291,28 @@ class LogMessage {
 
  private:
   friend class LogMessageForTesting;
+  friend class AsyncLogWriter;
+  friend class LogCallSite;
+  friend class LogLimiter;
+
+  // Outputs a finished line to the debug output and the sinks. A |forced|
+  // line was enabled by SetVModule() and skips their severity checks.
+  static void Dispatch(const std::string& str,
+                       LoggingSeverity severity,
+                       const char* tag,
+                       bool forced);
+
+  // Makes every LogCallSite look up its level again.
+  static void BumpGeneration();
+
+  static std::atomic<uint32_t> generation_;
 
   // Updates min_sev_ appropriately when debug sinks change.
   static void UpdateMinLogSeverity();
+  // Publishes a copy of |streams_| to the logging threads and waits until
+  // none of them can still be using the previous one. Called with
+  // g_log_mutex_ held.
+  static void PublishSinks();
 
 // These write out the actual log messages.
 #if defined(__ANDROID__)
@@ -242,6 +335,9 @@ class LogMessage {
   // The severity level of this message
   LoggingSeverity severity_;
 
+  // Whether the line is enabled for its file by SetVModule().
+  bool forced_ = false;
+
 #if defined(__ANDROID__)
   // The default Android debug output tag.
   const char* tag_ = "Native";
@@ -260,6 +356,9 @@ class LogMessage {
   // are added/removed.
   static std::atomic<bool> streams_empty_;
 
+  // Whether finished lines go to the AsyncLogWriter.
+  static std::atomic<bool> async_;
+
   // Flags for formatting options
   static bool thread_, timestamp_;
 
@@ -273,29 +372,131 @@ class LogMessage {
 #endif
 
  private:
+  LogMessage(const char* file,
+             const char* basename,
+             int line,
+             LoggingSeverity sev,
+             LogErrorContext err_ctx,
+             int err);
+
   LogMessage(const LogMessage&) = delete;
   LogMessage& operator=(const LogMessage&) = delete;
 };
 
+// Caches whether one LOGx call site is enabled. The flag is stored with the
+// LogMessage::Generation() it was computed for, so as long as the levels
+// don't change a disabled call site costs two loads, a compare and a branch.
+class LogCallSite {
+ public:
+  bool IsOn(const char* file, LoggingSeverity sev) {
+    const uint32_t state = state_.load(std::memory_order_relaxed);
+    if ((state >> 1) == LogMessage::Generation())
+      return state & 1;
+    return Update(file, sev);
+  }
+
+ private:
+  bool Update(const char* file, LoggingSeverity sev);
+
+  // Generation << 1 | enabled. Generations start at 1, so a new call site
+  // is always stale.
+  std::atomic<uint32_t> state_{0};
+};
+
+// Per call site state of the rate limited macros below. Each method decides
+// whether the current line goes out: it returns -1 to drop it, or the number
+// of lines this call site dropped since the last one it let through, which
+// is then printed in front of the message. Lock-free, a dropped line costs
+// an atomic increment at most.
+class LogLimiter {
+ public:
+  // Every |n|th line, starting with the first.
+  int64_t EveryN(uint32_t n);
+  // The first |n| lines only, the rest are dropped without a summary.
+  int64_t FirstN(uint32_t n);
+  // At most one line every |period_ns|.
+  int64_t EveryT(int64_t period_ns);
+  // Each line with a probability of 1/|one_in|.
+  int64_t Sampled(uint32_t one_in);
+
+ private:
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> suppressed_{0};
+  std::atomic<int64_t> next_ns_{0};
+};
+
+// "[N suppressed] " in front of a rate limited line, nothing if N is 0.
+struct LogSuppressed {
+  int64_t count;
+};
+
+template <typename Stream>
+Stream& operator<<(Stream& stream, LogSuppressed suppressed) {
+  if (suppressed.count > 0)
+    stream << "[" << suppressed.count << " suppressed] ";
+  return stream;
+}
+
+#define TUYA_LOG_IS_ON(sev)                                   \
+  (LOG_IS_ON && [] {                                          \
+    static tuya::LogCallSite site;                            \
+    return &site;                                             \
+  }()->IsOn(__FILE__, sev))
+
+// Trimmed at compile time, see LogBasename().
+#define TUYA_LOG_BASENAME()                                         \
+  [] {                                                              \
+    constexpr const char* basename = tuya::LogBasename(__FILE__);   \
+    return basename;                                                \
+  }()
+
+#define TUYA_LOG_METADATA(sev) tuya::LogMetadata(__FILE__, __LINE__, sev)
+#define TUYA_LOG_ERRNO_METADATA(sev) \
+  tuya::LogMetadataErr{TUYA_LOG_METADATA(sev), tuya::LogErrorContext::ERRCTX_ERRNO, errno}
+
 #ifndef __ANDROID__
-#define LOGV if (LOG_IS_ON && (tuya::LoggingSeverity::LS_VERBOSE <= tuya::LogMessage::GetMinLogSeverity())) \
-		tuya::LogMessage(__FILE__, __LINE__, tuya::LoggingSeverity::LS_VERBOSE).stream()
-#define LOGI if (LOG_IS_ON && (tuya::LoggingSeverity::LS_INFO <= tuya::LogMessage::GetMinLogSeverity())) \
-		tuya::LogMessage(__FILE__, __LINE__, tuya::LoggingSeverity::LS_INFO).stream()
-#define LOGW if (LOG_IS_ON && (tuya::LoggingSeverity::LS_WARNING <= tuya::LogMessage::GetMinLogSeverity())) \
-		tuya::LogMessage(__FILE__, __LINE__, tuya::LoggingSeverity::LS_WARNING).stream()
-#define LOGE if (LOG_IS_ON) tuya::LogMessage(__FILE__, __LINE__, tuya::LoggingSeverity::LS_ERROR).stream()
-#define LOGS if (LOG_IS_ON) tuya::LogMessage(__FILE__, __LINE__, tuya::LoggingSeverity::LS_ERROR, tuya::LogErrorContext::ERRCTX_ERRNO, errno).stream()
+#define TUYA_LOG_MESSAGE(sev) \
+  tuya::LogMessage(TUYA_LOG_METADATA(sev), TUYA_LOG_BASENAME())
 #else
-#define LOGV if (LOG_IS_ON && (tuya::LoggingSeverity::LS_VERBOSE <= tuya::LogMessage::GetMinLogSeverity())) \
-		tuya::LogMessage(__FILE__, __LINE__, LoggingSeverity::LS_VERBOSE, "Native").stream()
-#define LOGI if (LOG_IS_ON && (tuya::LoggingSeverity::LS_INFO <= tuya::LogMessage::GetMinLogSeverity())) \
-		tuya::LogMessage(__FILE__, __LINE__, LoggingSeverity::LS_INFO, "Native").stream()
-#define LOGW if (LOG_IS_ON && (tuya::LoggingSeverity::LS_WARNING <= tuya::LogMessage::GetMinLogSeverity())) \
-		tuya::LogMessage(__FILE__, __LINE__, tuya::LoggingSeverity::LS_WARNING, "Native").stream()
-#define LOGE if (LOG_IS_ON) tuya::LogMessage(__FILE__, __LINE__, tuya::LoggingSeverity::LS_ERROR, "Native").stream()
-#define LOGS if (LOG_IS_ON) tuya::LogMessage(__FILE__, __LINE__, tuya::LoggingSeverity::LS_ERROR, tuya::LogErrorContext::ERRCTX_ERRNO, errno).stream()
+#define TUYA_LOG_MESSAGE(sev) \
+  tuya::LogMessage(TUYA_LOG_METADATA(sev), TUYA_LOG_BASENAME(), "Native")
 #endif
+#define LOGV if (TUYA_LOG_IS_ON(tuya::LoggingSeverity::LS_VERBOSE)) \
+		TUYA_LOG_MESSAGE(tuya::LoggingSeverity::LS_VERBOSE).stream()
+#define LOGI if (TUYA_LOG_IS_ON(tuya::LoggingSeverity::LS_INFO)) \
+		TUYA_LOG_MESSAGE(tuya::LoggingSeverity::LS_INFO).stream()
+#define LOGW if (TUYA_LOG_IS_ON(tuya::LoggingSeverity::LS_WARNING)) \
+		TUYA_LOG_MESSAGE(tuya::LoggingSeverity::LS_WARNING).stream()
+#define LOGE if (TUYA_LOG_IS_ON(tuya::LoggingSeverity::LS_ERROR)) \
+		TUYA_LOG_MESSAGE(tuya::LoggingSeverity::LS_ERROR).stream()
+#define LOGS if (TUYA_LOG_IS_ON(tuya::LoggingSeverity::LS_ERROR)) \
+		tuya::LogMessage(TUYA_LOG_ERRNO_METADATA(tuya::LoggingSeverity::LS_ERROR), TUYA_LOG_BASENAME()).stream()
+
+// Rate limited logging for paths that can fire in storms, e.g.
+//   LOG_EVERY_T(tuya::LS_WARNING, 1) << "write failed: " << err;
+// prints at most one line a second, prefixed with the number of lines
+// dropped before it. The limiter is only consulted when the severity is on.
+#define TUYA_LOG_LIMITER()                                    \
+  [] {                                                        \
+    static tuya::LogLimiter limiter;                          \
+    return &limiter;                                          \
+  }()
+
+#define TUYA_LOG_LIMITED(sev, decide)                                       \
+  for (int64_t tuya_suppressed =                                            \
+           TUYA_LOG_IS_ON(sev) ? TUYA_LOG_LIMITER()->decide : -1;           \
+       tuya_suppressed >= 0; tuya_suppressed = -1)                          \
+    TUYA_LOG_MESSAGE(sev).stream() << tuya::LogSuppressed{tuya_suppressed}
+
+#define LOG_EVERY_N(sev, n) TUYA_LOG_LIMITED(sev, EveryN(n))
+#define LOG_FIRST_N(sev, n) TUYA_LOG_LIMITED(sev, FirstN(n))
+#define LOG_EVERY_T(sev, seconds) \
+  TUYA_LOG_LIMITED(sev, EveryT(static_cast<int64_t>((seconds) * 1e9)))
+#define LOG_SAMPLED(sev, one_in) TUYA_LOG_LIMITED(sev, Sampled(one_in))
+
+#define LOGI_SAMPLED(one_in) LOG_SAMPLED(tuya::LoggingSeverity::LS_INFO, one_in)
+#define LOGW_SAMPLED(one_in) LOG_SAMPLED(tuya::LoggingSeverity::LS_WARNING, one_in)
+#define LOGE_SAMPLED(one_in) LOG_SAMPLED(tuya::LoggingSeverity::LS_ERROR, one_in)
 
 
 #if defined(__cplusplus)
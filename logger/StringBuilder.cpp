@@ -21,17 +21,31 @@ StringBuilder& StringBuilder::AppendFormat(const char* fmt, ...) {
   va_list args, copy;
   va_start(args, fmt);
   va_copy(copy, args);
-  const int predicted_length = std::vsnprintf(nullptr, 0, fmt, copy);
+  // Straight into the free space first, it usually fits.
+  const size_t available = capacity_ - size_;
+  const int length = std::vsnprintf(data_ + size_, available, fmt, copy);
   va_end(copy);
 
-  if (predicted_length > 0) {
-    const size_t size = str_.size();
-    str_.resize(size + predicted_length);
-    // Pass "+ 1" to vsnprintf to include space for the '\0'.
-	std::vsnprintf(&str_[size], predicted_length + 1, fmt, args);
+  if (length > 0) {
+    if (static_cast<size_t>(length) >= available) {
+      // Pass "+ 1" to vsnprintf to include space for the '\0'.
+      Grow(size_ + length + 1);
+      std::vsnprintf(data_ + size_, length + 1, fmt, args);
+    }
+    size_ += length;
   }
   va_end(args);
   return *this;
 }
 
+void StringBuilder::Grow(size_t min_capacity) {
+  const size_t capacity = std::max(min_capacity, capacity_ * 2);
+  char* data = new char[capacity];
+  memcpy(data, data_, size_);
+  if (data_ != inline_)
+    delete[] data_;
+  data_ = data;
+  capacity_ = capacity;
+}
+
 } // namespace tuya
@@ -1,8 +1,13 @@
 #ifndef __STRING_BUILDER_H__
 #define __STRING_BUILDER_H__
+#include <algorithm>
+#include <charconv>
 #include <cstdio>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <stddef.h>
+#include <stdint.h>
 #include <limits>
 #include <utility>
 
@@ -19,79 +24,96 @@ char (&ArraySizeHelper(T (&array)[N]))[N];
 #define CHECK_LE(x, y)
 #endif
 
+// Builds a string in an inline buffer, moving to the heap only once it
+// outgrows it, so a typical log line is built without allocating. Numbers
+// are formatted with std::to_chars straight into the storage; doubles the
+// way an ostream does by default (%g).
 class StringBuilder {
  public:
+  static constexpr size_t kInlineCapacity = 256;
+
   StringBuilder() {}
-  explicit StringBuilder(std::string s) : str_(s) {}
+  explicit StringBuilder(std::string_view s) { Append(s.data(), s.size()); }
+  ~StringBuilder() {
+    if (data_ != inline_)
+      delete[] data_;
+  }
 
   StringBuilder(const StringBuilder&) = delete;
   StringBuilder& operator=(const StringBuilder&) = delete;
 
-  StringBuilder& operator<<(const std::string str) {
-    str_.append(str.data(), str.length());
-    return *this;
+  StringBuilder& operator<<(const std::string& str) {
+    return Append(str.data(), str.size());
   }
 
-  StringBuilder& operator<<(char c) = delete;
-
-  StringBuilder& operator<<(int i) {
-    str_ += ToString(i);
-    return *this;
+  StringBuilder& operator<<(std::string_view str) {
+    return Append(str.data(), str.size());
   }
 
-  StringBuilder& operator<<(unsigned i) {
-    str_ += ToString(i);
-    return *this;
+  StringBuilder& operator<<(const char* str) {
+    return str ? Append(str, strlen(str)) : Append("(null)", 6);
   }
 
+  StringBuilder& operator<<(char c) { return Append(&c, 1); }
+
+  StringBuilder& operator<<(int i) { return AppendInteger(i); }
+
+  StringBuilder& operator<<(unsigned i) { return AppendInteger(i); }
+
   StringBuilder& operator<<(long i) {  // NOLINT
-    str_ += ToString(i);
-    return *this;
+    return AppendInteger(i);
   }
 
   StringBuilder& operator<<(long long i) {  // NOLINT
-    str_ += ToString(i);
-    return *this;
+    return AppendInteger(i);
   }
 
   StringBuilder& operator<<(unsigned long i) {  // NOLINT
-    str_ += ToString(i);
-    return *this;
+    return AppendInteger(i);
   }
 
   StringBuilder& operator<<(unsigned long long i) {  // NOLINT
-    str_ += ToString(i);
-    return *this;
+    return AppendInteger(i);
   }
 
   StringBuilder& operator<<(float f) {
-    str_ += ToString((double)f);
-    return *this;
+    return AppendFloat(static_cast<double>(f), "%g");
   }
 
-  StringBuilder& operator<<(double f) {
-    str_ += ToString(f);
-    return *this;
-  }
+  StringBuilder& operator<<(double f) { return AppendFloat(f, "%g"); }
+
+  StringBuilder& operator<<(long double f) { return AppendFloat(f, "%Lg"); }
 
-  StringBuilder& operator<<(long double f) {
-    str_ += ToString(f);
+  // As an ostream does: in hex with a 0x prefix.
+  StringBuilder& operator<<(const void* p) {
+    char* out = Reserve(2 + 2 * sizeof(p));
+    out[0] = '0';
+    out[1] = 'x';
+    auto result = std::to_chars(out + 2, out + 2 + 2 * sizeof(p),
+                                reinterpret_cast<uintptr_t>(p), 16);
+    size_ = result.ptr - data_;
     return *this;
   }
 
+  std::string str() const { return std::string(data_, size_); }
 
-  const std::string& str() const { return str_; }
+  std::string_view view() const { return std::string_view(data_, size_); }
 
-  void Clear() { str_.clear(); }
+  void Clear() { size_ = 0; }
 
-  size_t size() const { return str_.size(); }
+  size_t size() const { return size_; }
 
   std::string Release() {
-    std::string ret = std::move(str_);
-    str_.clear();
+    std::string ret(data_, size_);
+    size_ = 0;
     return ret;
   }
 
+  StringBuilder& Append(const char* str, size_t length) {
+    memcpy(Reserve(length), str, length);
+    size_ += length;
+    return *this;
+  }
 
   // Allows appending a printf style formatted string.
   StringBuilder& AppendFormat(const char* fmt, ...)
@@ -100,87 +122,45 @@ class StringBuilder {
 #endif
       ;
 
-
-  inline std::string ToString(const char* const s) {
-    return std::string(s);
-  }
-  inline std::string ToString(const std::string s) {
-    return s;
-  }
-
-  inline std::string ToString(const short s) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%hd", s);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
-  }
-  inline std::string ToString(const unsigned short s) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%hu", s);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
-  }
-  inline std::string ToString(const int s) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%d", s);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
-  }
-  inline std::string ToString(const unsigned int s) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%u", s);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
-  }
-  inline std::string ToString(const long int s) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%ld", s);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
-  }
-  inline std::string ToString(const unsigned long int s) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%lu", s);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
-  }
-  inline std::string ToString(const long long int s) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%lld", s);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
-  }
-  inline std::string ToString(const unsigned long long int s) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%llu", s);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
+ private:
+  // Makes room for |length| more characters and returns where they go.
+  char* Reserve(size_t length) {
+    if (size_ + length > capacity_)
+      Grow(size_ + length);
+    return data_ + size_;
   }
 
-  inline std::string ToString(const double d) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%g", d);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
-  }
+  void Grow(size_t min_capacity);
 
-  inline std::string ToString(const long double d) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%Lg", d);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
+  template <typename T>
+  StringBuilder& AppendInteger(T value) {
+    char* out = Reserve(std::numeric_limits<T>::digits10 + 2);
+    size_ = std::to_chars(out, data_ + capacity_, value).ptr - data_;
+    return *this;
   }
 
-  inline std::string ToString(const void* const p) {
-    char buf[32];
-    const int len = std::snprintf(&buf[0], arraysize(buf), "%p", p);
-    CHECK_LE(len, arraysize(buf));
-    return std::string(&buf[0], len);
+  template <typename T>
+  StringBuilder& AppendFloat(T value, const char* format) {
+    // Enough for "%g" of any double, including the exponent.
+    constexpr size_t kMaxLength = 32;
+    char* out = Reserve(kMaxLength);
+#if defined(__cpp_lib_to_chars)
+    (void)format;
+    auto result = std::to_chars(out, out + kMaxLength, value,
+                                std::chars_format::general, 6);
+    size_ = result.ptr - data_;
+#else
+    const int length = std::snprintf(out, kMaxLength, format, value);
+    if (length > 0)
+      size_ += std::min(static_cast<size_t>(length), kMaxLength - 1);
+#endif
+    return *this;
   }
 
-
- private:
-  std::string str_;
+  char inline_[kInlineCapacity];
+  char* data_ = inline_;
+  size_t size_ = 0;
+  size_t capacity_ = kInlineCapacity;
 };
 } // namespace tuya
 
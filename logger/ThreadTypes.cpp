@@ -10,7 +10,14 @@
 
 #include "ThreadTypes.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+
 #if defined(__LINUX__)
+#include <dirent.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 #endif
@@ -33,7 +40,9 @@ typedef HRESULT(WINAPI* RTC_SetThreadDescription)(HANDLE hThread,
 #endif
 
 
-PlatformThreadId CurrentThreadId() {
+namespace {
+
+PlatformThreadId SystemThreadId() {
 #if defined(WIN)
   return GetCurrentThreadId();
 #elif defined(__APPLE__)
@@ -52,6 +61,149 @@ PlatformThreadId CurrentThreadId() {
 #endif
 }
 
+// What this thread knows about itself. Named threads are also listed in
+// NamedThreads() until they exit.
+struct CurrentThread {
+  ~CurrentThread();
+
+  PlatformThreadId id = 0;
+  bool registered = false;
+  char name[64] = {0};
+};
+
+// Leaked on purpose, threads may exit during static destruction.
+std::mutex& ThreadsMutex() {
+  static std::mutex* const mutex = new std::mutex;
+  return *mutex;
+}
+
+std::vector<CurrentThread*>& NamedThreads() {
+  static std::vector<CurrentThread*>* const threads =
+      new std::vector<CurrentThread*>;
+  return *threads;
+}
+
+CurrentThread& Current() {
+  static thread_local CurrentThread current;
+  return current;
+}
+
+CurrentThread::~CurrentThread() {
+  if (!registered)
+    return;
+  std::lock_guard<std::mutex> _(ThreadsMutex());
+  auto& threads = NamedThreads();
+  for (size_t i = 0; i < threads.size(); i++) {
+    if (threads[i] == this) {
+      threads[i] = threads.back();
+      threads.pop_back();
+      break;
+    }
+  }
+}
+
+#if defined(__POSIX__)
+// The registry lock is held across fork() so the child gets it unlocked.
+// The forking thread is the only one left in the child and has a new id.
+void LockBeforeFork() {
+  ThreadsMutex().lock();
+}
+
+void UnlockAfterFork() {
+  ThreadsMutex().unlock();
+}
+
+void ResetAfterFork() {
+  CurrentThread& current = Current();
+  current.id = 0;
+  auto& threads = NamedThreads();
+  threads.clear();
+  if (current.registered)
+    threads.push_back(&current);
+  ThreadsMutex().unlock();
+}
+#endif
+
+}  // namespace
+
+PlatformThreadId CurrentThreadId() {
+  CurrentThread& current = Current();
+  if (current.id == 0) {
+#if defined(__POSIX__)
+    static std::once_flag once;
+    std::call_once(once, [] {
+      pthread_atfork(LockBeforeFork, UnlockAfterFork, ResetAfterFork);
+    });
+#endif
+    current.id = SystemThreadId();
+  }
+  return current.id;
+}
+
+const char* CurrentThreadName() {
+  return Current().name;
+}
+
+std::vector<ThreadInfo> GetLiveThreads() {
+  std::vector<ThreadInfo> named;
+  {
+    std::lock_guard<std::mutex> _(ThreadsMutex());
+    for (const CurrentThread* thread : NamedThreads())
+      named.push_back({thread->id, thread->name, 0});
+  }
+
+#if defined(__LINUX__)
+  std::vector<ThreadInfo> threads;
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr)
+    return named;
+  static const long ticks_per_second = sysconf(_SC_CLK_TCK);
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+      continue;
+    ThreadInfo info = {static_cast<PlatformThreadId>(atoi(entry->d_name)),
+                       std::string(), 0};
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat",
+             static_cast<int>(info.id));
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+      continue;  // Exited meanwhile.
+    char stat[512];
+    const size_t size = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[size] = '\0';
+
+    // "tid (comm) state ppid ..." where comm may hold spaces and parens,
+    // utime and stime are the 14th and 15th fields.
+    const char* open = strchr(stat, '(');
+    const char* close = strrchr(stat, ')');
+    if (open == nullptr || close == nullptr || close < open)
+      continue;
+    info.name.assign(open + 1, close - open - 1);
+    const char* field = close + 1;
+    for (int i = 3; i < 14 && field != nullptr; i++)
+      field = strchr(field + 1, ' ');
+    unsigned long long utime = 0, stime = 0;
+    if (field != nullptr && ticks_per_second > 0 &&
+        sscanf(field, " %llu %llu", &utime, &stime) == 2) {
+      info.cpu_time_ns = (utime + stime) * 1000000000ull / ticks_per_second;
+    }
+
+    for (const ThreadInfo& thread : named) {
+      if (thread.id == info.id)
+        info.name = thread.name;
+    }
+    threads.push_back(std::move(info));
+  }
+  closedir(dir);
+  return threads;
+#else
+  return named;
+#endif
+}
+
 PlatformThreadRef CurrentThreadRef() {
 #if defined(WIN)
   return GetCurrentThreadId();
@@ -74,6 +226,17 @@ bool IsThreadRefEqual(const PlatformThreadRef& a, const PlatformThreadRef& b) {
 }
 
 void SetCurrentThreadName(const char* name) {
+  CurrentThread& current = Current();
+  {
+    std::lock_guard<std::mutex> _(ThreadsMutex());
+    strncpy(current.name, name, sizeof(current.name) - 1);
+    if (!current.registered) {
+      CurrentThreadId();
+      NamedThreads().push_back(&current);
+      current.registered = true;
+    }
+  }
+
 #if defined(WIN)
   // The SetThreadDescription API works even if no debugger is attached.
   // The names set with this API also show up in ETW traces. Very handy.
@@ -112,9 +275,9 @@ void SetCurrentThreadName(const char* name) {
   } __except (EXCEPTION_EXECUTE_HANDLER) {  // NOLINT
   }
 #pragma warning(pop)
-#elif defined(WEBRTC_LINUX) || defined(__ANDROID__)
+#elif defined(__LINUX__) || defined(__ANDROID__)
   prctl(PR_SET_NAME, reinterpret_cast<unsigned long>(name));  // NOLINT
-#elif defined(WEBRTC_MAC) || defined(WEBRTC_IOS)
+#elif defined(__APPLE__)
   pthread_setname_np(name);
 #endif
 }
@@ -19,6 +19,11 @@
 #endif
 #endif
 // clang-format on
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
 namespace tuya {
 
 
@@ -33,7 +38,8 @@ typedef pid_t PlatformThreadId;
 typedef pthread_t PlatformThreadRef;
 #endif
 
-// Retrieve the ID of the current thread.
+// Retrieve the ID of the current thread. Cached per thread after the first
+// call, so it costs no syscall.
 PlatformThreadId CurrentThreadId();
 
 // Retrieves a reference to the current thread. On Windows, this is the same
@@ -44,9 +50,26 @@ PlatformThreadRef CurrentThreadRef();
 // Compares two thread identifiers for equality.
 bool IsThreadRefEqual(const PlatformThreadRef& a, const PlatformThreadRef& b);
 
-// Sets the current thread name.
+// Sets the current thread name, and remembers it for the log headers and
+// GetLiveThreads().
 void SetCurrentThreadName(const char* name);
 
+// The name given to SetCurrentThreadName() on this thread, "" if none.
+const char* CurrentThreadName();
+
+struct ThreadInfo {
+  PlatformThreadId id;
+  std::string name;
+  // User plus system CPU time so far, 0 where it can't be read.
+  uint64_t cpu_time_ns;
+};
+
+// Threads of the process, for diagnostics. On Linux every thread listed in
+// /proc/self/task, with its CPU time; names set through
+// SetCurrentThreadName() win over the kernel's 15 character ones. Elsewhere
+// only the threads that named themselves.
+std::vector<ThreadInfo> GetLiveThreads();
+
 } // namespace tuya
 
 
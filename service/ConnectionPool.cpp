@@ -0,0 +1,109 @@
+#include "ConnectionPool.h"
+#include "HttpConnection.h"
+
+namespace ndcp {
+
+ConnectionPool::ConnectionPool(size_t capacity) : capacity_(capacity) {
+
+}
+
+ConnectionPool::~ConnectionPool() {
+	for (auto *connection : free_)
+		delete connection;
+}
+
+HttpConnection* ConnectionPool::acquire(HttpLoopContext *context) {
+	HttpConnection *connection;
+	if (!free_.empty()) {
+		connection = free_.back();
+		free_.pop_back();
+		pooled_.store(free_.size(), std::memory_order_relaxed);
+		connection->Reset();
+	} else {
+		connection = new HttpConnection(context);
+		created_.fetch_add(1, std::memory_order_relaxed);
+	}
+	connection->poolPrev = nullptr;
+	connection->poolNext = liveHead_;
+	if (liveHead_)
+		liveHead_->poolPrev = connection;
+	liveHead_ = connection;
+	uint32_t slot;
+	if (!freeSlots_.empty()) {
+		slot = freeSlots_.back();
+		freeSlots_.pop_back();
+	} else {
+		slot = static_cast<uint32_t>(slots_.size());
+		slots_.emplace_back();
+	}
+	slots_[slot].connection = connection;
+	connection->id = static_cast<uint64_t>(slots_[slot].generation) << 32 | slot;
+	live_.fetch_add(1, std::memory_order_relaxed);
+	return connection;
+}
+
+void ConnectionPool::release(HttpConnection *connection) {
+	if (connection->poolPrev)
+		connection->poolPrev->poolNext = connection->poolNext;
+	else
+		liveHead_ = connection->poolNext;
+	if (connection->poolNext)
+		connection->poolNext->poolPrev = connection->poolPrev;
+	connection->poolPrev = connection->poolNext = nullptr;
+	Slot &slot = slots_[static_cast<uint32_t>(connection->id)];
+	slot.connection = nullptr;
+	slot.generation++;
+	freeSlots_.push_back(static_cast<uint32_t>(connection->id));
+	live_.fetch_sub(1, std::memory_order_relaxed);
+
+	if (free_.size() >= capacity_) {
+		delete connection;
+	} else {
+		free_.push_back(connection);
+		pooled_.store(free_.size(), std::memory_order_relaxed);
+	}
+
+	if (liveHead_ == nullptr && drained_) {
+		// Last thing we do, |done| may delete the pool.
+		std::function<void()> done = std::move(drained_);
+		drained_ = nullptr;
+		done();
+	}
+}
+
+HttpConnection* ConnectionPool::find(uint64_t id) const {
+	const uint32_t index = static_cast<uint32_t>(id);
+	if (index >= slots_.size())
+		return nullptr;
+	const Slot &slot = slots_[index];
+	if (slot.generation != static_cast<uint32_t>(id >> 32))
+		return nullptr;
+	return slot.connection;
+}
+
+void ConnectionPool::closeAll() {
+	for (HttpConnection *connection = liveHead_; connection;
+			connection = connection->poolNext) {
+		// The close callbacks, hence release(), run later.
+		connection->Abort();
+	}
+}
+
+void ConnectionPool::whenDrained(std::function<void()> done) {
+	if (liveHead_ == nullptr) {
+		done();
+		return;
+	}
+	drained_ = std::move(done);
+}
+
+void ConnectionPool::setCapacity(size_t capacity) {
+	capacity_ = capacity;
+	while (free_.size() > capacity_) {
+		delete free_.back();
+		free_.pop_back();
+	}
+	pooled_.store(free_.size(), std::memory_order_relaxed);
+}
+
+} // namespace ndcp
@@ -0,0 +1,74 @@
+#ifndef __NDCP_CONNECTION_POOL_H__
+#define __NDCP_CONNECTION_POOL_H__
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace ndcp {
+
+class HttpConnection;
+struct HttpLoopContext;
+
+/*
+ * Per-loop free list of closed HttpConnections. A connection goes back to
+ * the pool from its close callback and is reset before being handed out
+ * again, so connection storms don't hit the allocator. At most |capacity|
+ * idle connections are kept, the rest are deleted.
+ *
+ * Everything but the gauges is loop thread only.
+ */
+class ConnectionPool {
+public:
+	explicit ConnectionPool(size_t capacity = 1024);
+	~ConnectionPool();
+
+	ConnectionPool(const ConnectionPool&) = delete;
+	ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+	// Hands out a connection under a new id, see HttpConnection::GetId().
+	HttpConnection* acquire(HttpLoopContext *context);
+	void release(HttpConnection *connection);
+	// The connection handed out as |id|, nullptr once it went back.
+	HttpConnection* find(uint64_t id) const;
+
+	void setCapacity(size_t capacity);
+
+	// Aborts every live connection, e.g. when the server stops. Those
+	// already closing gracefully are closed without waiting for their
+	// shutdown.
+	void closeAll();
+	// Runs |done| once no connection is live, right away if none is. |done|
+	// may destroy the pool.
+	void whenDrained(std::function<void()> done);
+
+	uint64_t live() const { return live_.load(std::memory_order_relaxed); }
+	uint64_t pooled() const { return pooled_.load(std::memory_order_relaxed); }
+	uint64_t created() const { return created_.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<HttpConnection*> free_;
+	// Intrusive list of the connections handed out.
+	HttpConnection *liveHead_ { nullptr };
+
+	/* Where find() looks an id up: its low half is the slot index, its high
+	 * half the generation of the slot, bumped when it is released. A stale
+	 * id would only match again after 2^32 reuses of its slot. */
+	struct Slot {
+		HttpConnection *connection { nullptr };
+		uint32_t generation { 0 };
+	};
+	// Only grow with the peak of live connections, reused after that.
+	std::vector<Slot> slots_;
+	std::vector<uint32_t> freeSlots_;
+	std::function<void()> drained_;
+	size_t capacity_;
+	std::atomic<uint64_t> live_ { 0 };
+	std::atomic<uint64_t> pooled_ { 0 };
+	std::atomic<uint64_t> created_ { 0 };
+};
+
+} // namespace ndcp
+
+#endif//__NDCP_CONNECTION_POOL_H__
@@ -1,13 +1,22 @@
 #include "HttpConnection.h"
+#include <cstring>
+#include <string>
+#include "../logger/Logging.h"
+#include "Looper.h"
 
 
-int OnUrl(http_parser* parser, const char *at, size_t length) {
+int OnMessageBegin(http_parser* parser) {
 	auto *connection = static_cast<ndcp::HttpConnection*>(parser->data);
-	printf("%s %s %d\n", __FILE__, __FUNCTION__, __LINE__);
-	printf("at: %s length %ld\n",at, length);
+	connection->OnRequestBegin();
 	return 0;
 }
 
+int OnUrl(http_parser* parser, const char *at, size_t length) {
+	auto *connection = static_cast<ndcp::HttpConnection*>(parser->data);
+	// May be called several times when the URL straddles two reads.
+	return connection->OnUrlData(at, length);
+}
+
 int OnStatus(http_parser* parser, const char *at, size_t length) {
 	auto *connection = static_cast<ndcp::HttpConnection*>(parser->data);
 	printf("%s %s %d\n", __FILE__, __FUNCTION__, __LINE__);
@@ -17,41 +26,30 @@ int OnStatus(http_parser* parser, const char *at, size_t length) {
 
 int OnHeaderField(http_parser* parser, const char *at, size_t length) {
 	auto *connection = static_cast<ndcp::HttpConnection*>(parser->data);
-	printf("%s %s %d\n", __FILE__, __FUNCTION__, __LINE__);
-	printf("at: %s length %ld\n",at, length);
-
-	return 0;
+	return connection->OnHeaderFieldData(at, length);
 }
 
 int OnHeaderValue(http_parser* parser, const char *at, size_t length) {
 	auto *connection = static_cast<ndcp::HttpConnection*>(parser->data);
-	printf("%s %s %d\n", __FILE__, __FUNCTION__, __LINE__);
-	printf("at: %s length %ld\n",at, length);
-
-	return 0;
+	return connection->OnHeaderValueData(at, length);
 }
 
 int OnHeaderComplete(http_parser* parser) {
 	auto *connection = static_cast<ndcp::HttpConnection*>(parser->data);
-	printf("%s %s %d\n", __FILE__, __FUNCTION__, __LINE__);
+	connection->OnHeadersComplete();
 	return 0;
 
 }
 
 int OnBody(http_parser* parser, const char *at, size_t length) {
 	auto *connection = static_cast<ndcp::HttpConnection*>(parser->data);
-	printf("%s %s %d\n", __FILE__, __FUNCTION__, __LINE__);
-	printf("at: %s length %ld\n",at, length);
-
-
-	connection->WriteResponse("add", 200);
-
-
+	connection->OnBodyData(at, length);
 	return 0;
 }
 
 int OnMessageComplete(http_parser* parser) {
 	auto *connection = static_cast<ndcp::HttpConnection*>(parser->data);
+	connection->OnRequestComplete(http_should_keep_alive(parser) != 0);
 	return 0;
 
 }
@@ -98,6 +96,10 @@ inline static void onShutdown(uv_shutdown_t *req, int /*status*/) {
 
 	delete req;
 
+	// Abort() may have closed it meanwhile, the shutdown is cancelled then.
+	if (uv_is_closing(reinterpret_cast<uv_handle_t*>(handle)))
+		return;
+
 	// Now do close the handle.
 	uv_close(reinterpret_cast<uv_handle_t*>(handle),
 			static_cast<uv_close_cb>(onClose));
@@ -105,10 +107,17 @@ inline static void onShutdown(uv_shutdown_t *req, int /*status*/) {
 
 
 namespace ndcp {
-HttpConnection::HttpConnection() {
+
+// Read buffers pinned by one request before it moves to the arena.
+static constexpr size_t kMaxRetainedReads = 4;
+
+HttpConnection::HttpConnection(HttpLoopContext *context) : context(context),
+		arena(&context->readPool), timeout([this]() { OnTimeout(); }) {
     http_parser_init(&parser, HTTP_REQUEST);
     parser.data = this;
 
+	http_parser_settings_init(&parser_settings);
+	parser_settings.on_message_begin = OnMessageBegin;
 	parser_settings.on_url = OnUrl;
 	parser_settings.on_status = OnStatus;
 	parser_settings.on_header_field = OnHeaderField;
@@ -119,41 +128,134 @@ HttpConnection::HttpConnection() {
 }
 
 HttpConnection::~HttpConnection() {
-
+	ReleaseRetainedReads();
+	ReleasePausedRead();
 }
 
 
 void HttpConnection::OnUvReadAlloc(size_t suggestedSize, uv_buf_t *buf) {
-	  buf->base = new char(suggestedSize);
-	  buf->len = suggestedSize;
-}
-void HttpConnection::OnUvRead(uv_handle_t* handle, ssize_t nread, const uv_buf_t *buf) {
-	  size_t parsed;
-	  HttpConnection* connection = (HttpConnection*)handle->data;
-	  if (nread == 0) {
-		  return;
-	  }
-
-	  if (nread >= 0) {
-	    parsed = http_parser_execute(
-	        &connection->parser, &connection->parser_settings, buf->base, nread);
-	    if (parsed < nread) {
-	      uv_close(reinterpret_cast<uv_handle_t*>( &connection->handle),
-	  			static_cast<uv_close_cb>(onClose));
-	    }
+	size_t len = 0;
+	buf->base = context->readPool.acquire(suggestedSize, &len);
+	buf->len = len;
+}
+void HttpConnection::OnUvRead(uv_handle_t* /*handle*/, ssize_t nread, const uv_buf_t *buf) {
+	  if (nread > 0) {
+		  // The header deadline is not pushed back by slow reads.
+		  if (!readingHeaders)
+			  ArmTimeout(context->idleTimeoutMs);
+		  // Anything pipelined behind a "Connection: close" request is dropped.
+		  if (!closeAfterResponses && !Parse(buf, 0, static_cast<size_t>(nread))) {
+			  // Kept until reading resumes.
+			  return;
+		  }
 	  } else if (nread == UV_EOF || nread == UV_ECONNRESET) {// Client disconnected.
 		  isClosedByPeer = true;
 		  // Close server side of the connection.
 		  Close();
-	  } else {	// Some error.
+	  } else if (nread < 0) {	// Some error.
 		  hasError = true;
 			// Close server side of the connection.
 			Close();
 	  }
-	  delete buf->base;
+	  RecycleRead(buf);
 
 }
 
+bool HttpConnection::Parse(const uv_buf_t *buf, size_t offset, size_t end) {
+	// A zero length would tell the parser the stream ended.
+	if (offset == end)
+		return true;
+
+	size_t parsed = http_parser_execute(&parser, &parser_settings, buf->base + offset,
+			end - offset);
+	if (HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED) {
+		pausedRead = *buf;
+		pausedOffset = offset + parsed;
+		pausedEnd = end;
+		return false;
+	}
+	if (!closed && parsed < end - offset) {
+		LOG_EVERY_T(tuya::LS_WARNING, 1) << "http parse error: "
+				<< http_errno_name(HTTP_PARSER_ERRNO(&parser));
+		hasError = true;
+		Close();
+	}
+	return true;
+}
+
+void HttpConnection::PauseReading() {
+	// Stops the parser right after this request, the rest of the read waits.
+	http_parser_pause(&parser, 1);
+	uv_read_stop(reinterpret_cast<uv_stream_t*>(&handle));
+	readPaused = true;
+}
+
+void HttpConnection::ResumeReading() {
+	readPaused = false;
+	http_parser_pause(&parser, 0);
+	uv_buf_t buf = pausedRead;
+	pausedRead = uv_buf_t {};
+	if (buf.base != nullptr) {
+		if (!Parse(&buf, pausedOffset, pausedEnd))
+			return;
+		RecycleRead(&buf);
+	}
+	if (closed || readPaused)
+		return;
+	int err = uv_read_start(reinterpret_cast<uv_stream_t*>(&handle),
+			static_cast<uv_alloc_cb>(onAlloc), static_cast<uv_read_cb>(onRead));
+	if (err != 0) {
+		hasError = true;
+		Close();
+	}
+}
+
+void HttpConnection::ReleasePausedRead() {
+	if (pausedRead.base != nullptr)
+		context->readPool.release(pausedRead.base, pausedRead.len);
+	pausedRead = uv_buf_t {};
+}
+
+void HttpConnection::RecycleRead(const uv_buf_t *buf) {
+	if (inRequest && readReferenced && !closed) {
+		if (retainedReads.size() < kMaxRetainedReads) {
+			// The request in progress still points into this buffer.
+			retainedReads.push_back(*buf);
+			readReferenced = false;
+			return;
+		}
+		// A request trickling in over many reads: move it to the arena
+		// rather than pinning more buffers.
+		if (!CompactRequest()) {
+			hasError = true;
+			Close();
+		}
+	}
+	readReferenced = false;
+	context->readPool.release(buf->base, buf->len);
+}
+
+bool HttpConnection::CompactRequest() {
+	auto move = [this](std::string_view &token) {
+		if (token.empty() || arena.owns(token.data()))
+			return true;
+		token = arena.copy(token);
+		return token.data() != nullptr;
+	};
+
+	bool ok = move(url);
+	for (size_t i = 0; ok && i < headers.size_; i++)
+		ok = move(headers.headers_[i].first) && move(headers.headers_[i].second);
+	ReleaseRetainedReads();
+	return ok;
+}
+
+void HttpConnection::ReleaseRetainedReads() {
+	for (auto &buf : retainedReads)
+		context->readPool.release(buf.base, buf.len);
+	retainedReads.clear();
+}
+
 void HttpConnection::OnUvWrite(int status) {
 
 	if (status != 0) {
@@ -161,46 +263,287 @@ void HttpConnection::OnUvWrite(int status) {
 			this->hasError = true;
 		}
 
-		printf("write error, closing the connection: %s\n",
-				uv_strerror(status));
+		LOG_EVERY_T(tuya::LS_WARNING, 1) << "write error, closing the connection: "
+				<< uv_strerror(status);
 
 		Close();
 	}
 }
 
 void HttpConnection::OnUvClose(uv_handle_t* handle) {
+	// The handle is gone and pending writes have been cancelled, nothing
+	// refers to this connection any more. May delete |this|.
+	context->connections.release(this);
+}
+
+void HttpConnection::Reset() {
+	http_parser_init(&parser, HTTP_REQUEST);
+	parser.data = this;
+
+	ReleaseRetainedReads();
+	ReleasePausedRead();
+	arena.reset();
+	headers.size_ = 0;
+	url = std::string_view();
+	body.clear();
+	lastHeaderEvent = HeaderEvent::None;
+	inRequest = false;
+	readReferenced = false;
+	readingHeaders = false;
+	readPaused = false;
+
+	responses.clear();
+	batch.clear();
+	// nextRequestSeq carries on, so a response to the previous client's
+	// request never matches one of the next client's.
+	closeAfterResponses = false;
+	isClosedByPeer = false;
+	hasError = false;
+	closed = false;
+}
+
+void HttpConnection::ArmTimeout(uint64_t timeoutMs) {
+	if (closed)
+		return;
+	if (timeoutMs > 0)
+		context->timers.start(&timeout, timeoutMs);
+	else
+		context->timers.stop(&timeout);
+}
+
+void HttpConnection::OnTimeout() {
+	if (closed)
+		return;
+
+	if (readingHeaders) {
+		context->headerTimeouts.fetch_add(1, std::memory_order_relaxed);
+		Abort();
+	} else {
+		context->idleTimeouts.fetch_add(1, std::memory_order_relaxed);
+		Close();
+	}
+}
+
+void HttpConnection::OnRequestBegin() {
+	inRequest = true;
+	readingHeaders = true;
+	ArmTimeout(context->headerTimeoutMs);
+	url = std::string_view();
+	headers.size_ = 0;
+	lastHeaderEvent = HeaderEvent::None;
+	// clear() keeps the capacity, so steady state requests don't allocate.
+	body.clear();
+}
+
+std::string_view HttpConnection::Reference(const char *at, size_t length) {
+	readReferenced = true;
+	return std::string_view(at, length);
+}
+
+std::string_view HttpConnection::AppendPiece(std::string_view head, const char *at,
+		size_t length) {
+	// The parser only splits a token at the end of a read, so |head| lives in
+	// a retained buffer (or the arena) and |at| in the current one.
+	context->headerStraddles.fetch_add(1, std::memory_order_relaxed);
+	return arena.concat(head, at, length);
+}
+
+int HttpConnection::OnUrlData(const char *at, size_t length) {
+	url = url.empty() ? Reference(at, length) : AppendPiece(url, at, length);
+	return url.data() == nullptr ? -1 : 0;
+}
+
+int HttpConnection::OnHeaderFieldData(const char *at, size_t length) {
+	if (lastHeaderEvent == HeaderEvent::Field) {
+		auto &name = headers.headers_[headers.size_ - 1].first;
+		name = AppendPiece(name, at, length);
+		return name.data() == nullptr ? -1 : 0;
+	}
+
+	if (headers.size_ == HttpHeaders::kMaxHeaders) {
+		LOG_EVERY_T(tuya::LS_WARNING, 1) << "too many request headers, closing the connection";
+		return -1;
+	}
+	headers.headers_[headers.size_++] = { Reference(at, length), std::string_view() };
+	lastHeaderEvent = HeaderEvent::Field;
+	return 0;
+}
+
+int HttpConnection::OnHeaderValueData(const char *at, size_t length) {
+	if (headers.size_ == 0)
+		return -1;
+
+	auto &value = headers.headers_[headers.size_ - 1].second;
+	if (lastHeaderEvent == HeaderEvent::Value) {
+		value = AppendPiece(value, at, length);
+		return value.data() == nullptr ? -1 : 0;
+	}
+	value = Reference(at, length);
+	lastHeaderEvent = HeaderEvent::Value;
+	return 0;
+}
 
+void HttpConnection::OnHeadersComplete() {
+	readingHeaders = false;
+	ArmTimeout(context->idleTimeoutMs);
 }
 
-void after_write(uv_write_t* req, int status) {
-  uv_close((uv_handle_t*)req->handle, nullptr);
+void HttpConnection::OnBodyData(const char *at, size_t length) {
+	body.append(at, length);
 }
-void HttpConnection::WriteResponse(const char *method, int responseCode) {
-	const char* RESPONSE = "HTTP/1.1 200 OK\r\n""Content-Type: text/plain\r\n""Content-Length: 14\r\n\r\n""Hello, World!\n";
-	size_t len = strlen(RESPONSE) + 1;
-	uv_buf_t buffer = uv_buf_init(
-			reinterpret_cast<char*>(const_cast<char*>(RESPONSE)), len);
+
+void HttpConnection::OnRequestComplete(bool keepAlive) {
+	if (closed)
+		return;
+
+	// Pipelined requests are answered in arrival order, so reserve a slot
+	// now and let the response fill it whenever it is ready.
+	PendingResponse slot;
+	slot.seq = nextRequestSeq++;
+	slot.keepAlive = keepAlive;
+	responses.push_back(std::move(slot));
+
+	if (!keepAlive)
+		closeAfterResponses = true;
+
+	HttpRequest request;
+	request.seq = CurrentRequest();
+	request.method = static_cast<http_method>(parser.method);
+	request.path = url;
+	size_t query = request.path.find('?');
+	if (query != std::string_view::npos) {
+		request.query = request.path.substr(query + 1);
+		request.path = request.path.substr(0, query);
+	}
+	request.body = body;
+	request.headers = &headers;
+
+	bool pathMatched = false;
+	const RouteHandler *handler = context->router ?
+			context->router->match(request.method, request.path, &request.params, &pathMatched) :
+			nullptr;
+	if (handler) {
+		(*handler)(this, request);
+	} else if (pathMatched) {
+		WriteResponse(request.seq, 405, "Method Not Allowed\n");
+	} else {
+		WriteResponse(request.seq, 404, "Not Found\n");
+	}
+
+	// Nothing points into the earlier reads any more.
+	inRequest = false;
+	readingHeaders = false;
+	readReferenced = false;
+	ReleaseRetainedReads();
+	arena.reset();
+
+	// Bounds what a client pipelining without reading the responses costs.
+	if (!closed && !closeAfterResponses && context->maxPipelined > 0 &&
+			responses.size() >= context->maxPipelined)
+		PauseReading();
+}
+
+uint64_t HttpConnection::CurrentRequest() const {
+	return nextRequestSeq - 1;
+}
+
+void HttpConnection::WriteResponse(uint64_t seq, int responseCode,
+		std::string_view content, const char *contentType) {
+	HttpResponse response(responseCode);
+	response.header("Content-Type", contentType);
+	response.body(std::string(content));
+	SendResponse(seq, std::move(response));
+}
+
+void HttpConnection::SendResponse(uint64_t seq, HttpResponse response) {
+	if (closed)
+		return;
+
+	for (auto &slot : responses) {
+		if (slot.seq == seq) {
+			response.finalize(slot.keepAlive);
+			slot.response.emplace(std::move(response));
+			break;
+		}
+	}
+	FlushResponses();
+}
+
+void HttpConnection::FlushResponses() {
+	// Everything ready at the head of the queue goes out in one write.
+	bool closeAfter = false;
+	while (!closed && !responses.empty() && responses.front().response) {
+		PendingResponse &slot = responses.front();
+		batch.push_back(std::move(*slot.response));
+		closeAfter = !slot.keepAlive;
+		responses.pop_front();
+		if (closeAfter)
+			break;
+	}
+	if (batch.empty())
+		return;
+
+	Write();
+	if (closeAfter) {
+		// uv_shutdown() lets the queued writes go out before closing.
+		Close();
+	}
+	if (readPaused && !closed && responses.size() < context->maxPipelined)
+		ResumeReading();
+}
+
+void HttpConnection::Write() {
+	size_t len = 0;
+	iov.clear();
+	for (auto &response : batch) {
+		iov.push_back(uv_buf_init(const_cast<char*>(response.head_.data()),
+				response.head_.size()));
+		len += response.head_.size();
+		for (auto &segment : response.segments_) {
+			iov.push_back(uv_buf_init(const_cast<char*>(segment.data), segment.len));
+			len += segment.len;
+		}
+	}
+
 	int written = uv_try_write(reinterpret_cast<uv_stream_t*>(&handle),
-			&buffer, 1);
-	if (written == static_cast<int>(len)) {
+			iov.data(), iov.size());
+	if (written >= 0 && static_cast<size_t>(written) == len) {
+		batch.clear();
 		return;
 	} else if (written == UV_EAGAIN || written == UV_ENOSYS) {
 		// Cannot write any data at first time. Use uv_write().
 		written = 0;
 	} else if (written < 0) {
+		batch.clear();
 		Close();
 		return;
 	}
-	size_t pendingLen = len - written;
-	auto *writeData = new UvWriteData(pendingLen);
 
-	buffer = uv_buf_init(reinterpret_cast<char*>(writeData->store), pendingLen);
+	// Skip what already went out, the rest is queued in place.
+	size_t first = 0;
+	size_t skip = written;
+	while (skip >= iov[first].len) {
+		skip -= iov[first].len;
+		first++;
+	}
+	iov[first].base += skip;
+	iov[first].len -= skip;
+
+	// Moving the vector keeps the responses, hence the buffers the iovec
+	// points to, where they are. uv_write() copies the iovec itself.
+	auto *writeData = new UvWriteData;
+	writeData->req.data = writeData;
+	writeData->responses = std::move(batch);
+	batch.clear();
+
 	int err = uv_write(&writeData->req,
-			reinterpret_cast<uv_stream_t*>(&handle), &buffer, 1,
-			static_cast<uv_write_cb>(onWrite));
+			reinterpret_cast<uv_stream_t*>(&handle), iov.data() + first,
+			iov.size() - first, static_cast<uv_write_cb>(onWrite));
 	if (err != 0) {
-		printf("write failed %s\n", uv_strerror(err));
+		LOG_EVERY_T(tuya::LS_WARNING, 1) << "write failed " << uv_strerror(err);
 		delete writeData;
+		hasError = true;
+		Close();
 	}
 
 }
@@ -208,6 +551,7 @@ void HttpConnection::WriteResponse(const char *method, int responseCode) {
 
 void HttpConnection::Start() {
 	int err;
+	ArmTimeout(context->idleTimeoutMs);
 	err = uv_read_start(reinterpret_cast<uv_stream_t*>(&handle),
 				static_cast<uv_alloc_cb>(onAlloc), static_cast<uv_read_cb>(onRead));
 }
@@ -220,15 +564,15 @@ void HttpConnection::Close() {
 
 	int err;
 	closed = true;
-
-	// Tell the UV handle that the TcpConnection has been closed.
-	handle.data = nullptr;
+	context->timers.stop(&timeout);
+	ReleaseRetainedReads();
+	ReleasePausedRead();
 
 	// Don't read more.
 	err = uv_read_stop(reinterpret_cast<uv_stream_t*>(&handle));
 
 	if (err != 0)
-		printf("uv_read_stop() failed: %s\n", uv_strerror(err));
+		LOG_EVERY_T(tuya::LS_WARNING, 1) << "uv_read_stop() failed: " << uv_strerror(err);
 
 	// If there is no error and the peer didn't close its connection side then close gracefully.
 	if (!this->hasError && !this->isClosedByPeer) {
@@ -240,7 +584,10 @@ void HttpConnection::Close() {
 				static_cast<uv_shutdown_cb>(onShutdown));
 
 		if (err != 0) {
-			printf("uv_shutdown() failed: %s\n", uv_strerror(err));
+			LOG_EVERY_T(tuya::LS_WARNING, 1) << "uv_shutdown() failed: " << uv_strerror(err);
+			delete req;
+			uv_close(reinterpret_cast<uv_handle_t*>(&handle),
+					static_cast<uv_close_cb>(onClose));
 		}
 	}
 	// Otherwise directly close the socket.
@@ -250,10 +597,82 @@ void HttpConnection::Close() {
 	}
 }
 
+void HttpConnection::Abort() {
+	hasError = true;
+	if (!closed) {
+		Close();
+		return;
+	}
+	// A graceful Close() may still wait for its uv_shutdown(), don't.
+	auto *uvHandle = reinterpret_cast<uv_handle_t*>(&handle);
+	if (!uv_is_closing(uvHandle))
+		uv_close(uvHandle, static_cast<uv_close_cb>(onClose));
+}
+
 uv_tcp_t* HttpConnection::GetHandle() {
 	return &handle;
 }
 
+uint64_t HttpConnection::GetId() const {
+	return id;
+}
+
+HttpResponder HttpConnection::GetResponder(uint64_t seq) const {
+	return HttpResponder(context->responderTarget, id, seq);
+}
+
+/* A response on its way to the loop of its connection. */
+struct PostedResponse : TaskQueue::Node {
+	PostedResponse(std::shared_ptr<HttpResponderTarget> target, uint64_t connectionId,
+			uint64_t seq, HttpResponse response)
+		: target(std::move(target)), connectionId(connectionId), seq(seq),
+		  response(std::move(response)) {}
+
+	void run() override {
+		// Still queued when the server stopped, the connections may be gone.
+		std::unique_lock<std::mutex> lock(target->mutex);
+		HttpLoopContext *context = target->context;
+		lock.unlock();
+		if (context == nullptr)
+			return;
+		HttpConnection *connection = context->connections.find(connectionId);
+		if (connection)
+			connection->SendResponse(seq, std::move(response));
+	}
+
+	std::shared_ptr<HttpResponderTarget> target;
+	uint64_t connectionId;
+	uint64_t seq;
+	HttpResponse response;
+};
+
+HttpResponder::HttpResponder(std::weak_ptr<HttpResponderTarget> target,
+		uint64_t connectionId, uint64_t seq) : target(std::move(target)),
+		connectionId(connectionId), seq(seq) {
+}
+
+bool HttpResponder::Send(HttpResponse response) const {
+	std::shared_ptr<HttpResponderTarget> shared = target.lock();
+	if (!shared)
+		return false;
+	// Posting under the lock keeps the server from stopping meanwhile.
+	std::lock_guard<std::mutex> _(shared->mutex);
+	if (shared->context == nullptr)
+		return false;
+	return shared->context->looper->post(
+			new PostedResponse(shared, connectionId, seq, std::move(response)));
+}
+
+bool HttpResponder::Post(std::function<void()> task) const {
+	std::shared_ptr<HttpResponderTarget> shared = target.lock();
+	if (!shared)
+		return false;
+	std::lock_guard<std::mutex> _(shared->mutex);
+	if (shared->context == nullptr)
+		return false;
+	return shared->context->looper->post(std::move(task));
+}
+
 
 } // namespace ndcp
 
@@ -1,12 +1,102 @@
 #ifndef __HTTP_CONNECTION__
 #define __HTTP_CONNECTION__
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
 #include "uv.h"
 #include "http-parser/http_parser.h"
+#include "BufferPool.h"
+#include "ConnectionPool.h"
+#include "Timer.h"
+#include "HttpHeaders.h"
+#include "HttpResponse.h"
+#include "Router.h"
 namespace ndcp {
 
+class Looper;
+
+struct HttpLoopContext;
+
+/*
+ * What responders reach a loop through. Shared with the responders, so it
+ * outlives the loop; the server clears it when it stops.
+ */
+struct HttpResponderTarget {
+	std::mutex mutex;
+	// nullptr once the server stopped serving on the loop.
+	HttpLoopContext *context { nullptr };
+};
+
+/* Per-loop state shared by all the connections of that loop. */
+struct HttpLoopContext {
+	explicit HttpLoopContext(const BufferPool::Options &options) : readPool(options),
+			responderTarget(std::make_shared<HttpResponderTarget>()) {
+		responderTarget->context = this;
+	}
+
+	// Read buffers and request arenas. Loop thread only.
+	BufferPool readPool;
+	// Connection timeouts. Loop thread only.
+	TimerWheel timers;
+	// Close a connection with no traffic for that long, 0 disables.
+	uint64_t idleTimeoutMs { 60000 };
+	// Abort a request whose headers take longer than that (slowloris).
+	uint64_t headerTimeoutMs { 10000 };
+	// Requests of one connection waiting for their response before it stops
+	// reading, 0 for no limit.
+	size_t maxPipelined { 16 };
+	// Closed connections waiting for reuse. Loop thread only.
+	ConnectionPool connections;
+	// Without a router every request gets a 404.
+	const Router *router { nullptr };
+	// The Looper the connections live on.
+	Looper *looper { nullptr };
+	// Cleared by the server when it stops, see HttpResponder.
+	std::shared_ptr<HttpResponderTarget> responderTarget;
+	// URL or header tokens split across two reads, which had to be copied.
+	std::atomic<uint64_t> headerStraddles { 0 };
+	std::atomic<uint64_t> idleTimeouts { 0 };
+	std::atomic<uint64_t> headerTimeouts { 0 };
+};
+
+/*
+ * Answers a request from any thread. It names the connection by the id it
+ * was accepted under, looked up again on the connection's loop, so the
+ * response is dropped once that connection has closed, even when the object
+ * has been reused for another client or deleted since. It holds the loop
+ * weakly: once the server stopped, whether or not it was destroyed, nothing
+ * gets through any more. Copyable.
+ */
+class HttpResponder {
+public:
+	HttpResponder() = default;
+
+	// Posts |response| to the loop of the connection. Returns false, dropping
+	// it, once the server stopped.
+	bool Send(HttpResponse response) const;
+	// Runs |task| on the loop of the connection, e.g. to respond in several
+	// steps. Returns false, dropping it, once the server stopped.
+	bool Post(std::function<void()> task) const;
+	uint64_t GetSeq() const { return seq; }
+
+private:
+	friend class HttpConnection;
+	HttpResponder(std::weak_ptr<HttpResponderTarget> target, uint64_t connectionId,
+			uint64_t seq);
+
+	std::weak_ptr<HttpResponderTarget> target;
+	uint64_t connectionId { 0 };
+	uint64_t seq { 0 };
+};
+
 class HttpConnection {
 public:
-	HttpConnection();
+	explicit HttpConnection(HttpLoopContext *context);
 	virtual ~HttpConnection();
 public:
 	void OnUvReadAlloc(size_t suggestedSize, uv_buf_t *buf);
@@ -15,35 +105,110 @@ public:
 	void OnUvWrite(int status);
 	void Start();
 	void Close();
-	void WriteResponse(const char *method, int responseCode);
+	// Closes right away, without flushing pending writes, also when a
+	// graceful Close() is still waiting for them.
+	void Abort();
+	// Brings a closed connection back to its freshly constructed state, but
+	// keeps the capacity of its buffers and the request numbering. Used by
+	// ConnectionPool.
+	void Reset();
+	// Responds to request |seq| with a copy of |content| as the body.
+	void WriteResponse(uint64_t seq, int responseCode, std::string_view content,
+			const char *contentType = "text/plain");
+	// Parser events.
+	void OnRequestBegin();
+	int OnUrlData(const char *at, size_t length);
+	int OnHeaderFieldData(const char *at, size_t length);
+	int OnHeaderValueData(const char *at, size_t length);
+	void OnHeadersComplete();
+	void OnBodyData(const char *at, size_t length);
+	void OnRequestComplete(bool keepAlive);
+	// Sequence number of the request being dispatched.
+	uint64_t CurrentRequest() const;
+	// Hands over the response to request |seq|. Responses go out in request
+	// order, so this one may wait for earlier pipelined ones.
+	void SendResponse(uint64_t seq, HttpResponse response);
 	uv_tcp_t* GetHandle();
+	// Unique among the connections of the loop, changes on reuse.
+	uint64_t GetId() const;
+	// For handlers passing request |seq| on to another thread, which must
+	// not keep this pointer: the connection may be gone by the time it is
+	// done.
+	HttpResponder GetResponder(uint64_t seq) const;
 
 	/* Struct for the data field of uv_req_t when writing into the connection. */
 	struct UvWriteData
 	{
-		explicit UvWriteData(size_t storeSize)
-		{
-			this->store = new uint8_t[storeSize];
-		}
-
-		// Disable copy constructor because of the dynamically allocated data (store).
-		UvWriteData(const UvWriteData&) = delete;
-
-		~UvWriteData()
-		{
-			delete[] this->store;
-		}
-
 		uv_write_t req;
-		uint8_t* store{ nullptr };
+		// Own the buffers of the pending write until it completes.
+		std::vector<HttpResponse> responses;
 	};
 
 private:
 	  uv_tcp_t handle;
 	  http_parser parser;
 	  http_parser_settings parser_settings;
+	  HttpLoopContext *context;
+	  // Per-request state, reused across keep-alive requests. The views point
+	  // into the read buffers, which are retained while the request is in
+	  // progress, or into the arena for tokens that straddled two reads.
+	  RequestArena arena;
+	  HttpHeaders headers;
+	  std::string_view url;
+	  std::string body;
+
+private:
+	/* A response slot, reserved when its request completes. */
+	struct PendingResponse
+	{
+		uint64_t seq { 0 };
+		bool keepAlive { true };
+		// Empty until the handler responds.
+		std::optional<HttpResponse> response;
+	};
+
+	enum class HeaderEvent { None, Field, Value };
+
+	std::string_view Reference(const char *at, size_t length);
+	std::string_view AppendPiece(std::string_view head, const char *at, size_t length);
+	void ArmTimeout(uint64_t timeoutMs);
+	void OnTimeout();
+	void RecycleRead(const uv_buf_t *buf);
+	bool CompactRequest();
+	void ReleaseRetainedReads();
+	bool Parse(const uv_buf_t *buf, size_t offset, size_t end);
+	void PauseReading();
+	void ResumeReading();
+	void ReleasePausedRead();
+	void FlushResponses();
+	void Write();
 
 private:
+	friend class ConnectionPool;
+	HttpConnection *poolPrev { nullptr };
+	HttpConnection *poolNext { nullptr };
+	uint64_t id { 0 };
+
+	std::vector<uv_buf_t> retainedReads;
+	// Idle timeout, or the header deadline while readingHeaders.
+	Timer timeout;
+	bool readingHeaders { false };
+	HeaderEvent lastHeaderEvent { HeaderEvent::None };
+	bool inRequest { false };
+	bool readReferenced { false };
+	// Set while maxPipelined responses are pending. The parser stopped
+	// inside |pausedRead|, at |pausedOffset|, and goes on from there once
+	// they drain.
+	bool readPaused { false };
+	uv_buf_t pausedRead {};
+	size_t pausedOffset { 0 };
+	size_t pausedEnd { 0 };
+	std::deque<PendingResponse> responses;
+	// Responses being written and their iovec, reused across writes.
+	std::vector<HttpResponse> batch;
+	std::vector<uv_buf_t> iov;
+	uint64_t nextRequestSeq { 0 };
+	bool closeAfterResponses { false };
 	bool isClosedByPeer { false };
 	bool hasError { false };
 	bool closed { false };
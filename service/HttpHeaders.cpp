@@ -0,0 +1,103 @@
+#include "HttpHeaders.h"
+#include <cstring>
+
+namespace ndcp {
+
+static constexpr size_t kArenaBlockSize = 4096;
+
+RequestArena::RequestArena(BufferPool *pool) : pool_(pool) {
+
+}
+
+RequestArena::~RequestArena() {
+	for (auto &block : blocks_)
+		pool_->release(block.base, block.len);
+}
+
+char* RequestArena::allocate(size_t size) {
+	if (blocks_.empty() || blocks_.back().len - blocks_.back().used < size) {
+		Block block;
+		block.base = pool_->acquire(size < kArenaBlockSize ? kArenaBlockSize : size,
+				&block.len);
+		block.used = 0;
+		if (block.base == nullptr || block.len < size) {
+			pool_->release(block.base, block.len);
+			return nullptr;
+		}
+		blocks_.push_back(block);
+	}
+
+	Block &block = blocks_.back();
+	char *data = block.base + block.used;
+	block.used += size;
+	last_ = data;
+	return data;
+}
+
+std::string_view RequestArena::concat(std::string_view head, const char *tail,
+		size_t tailLen) {
+	if (last_ != nullptr && head.data() == last_) {
+		Block &block = blocks_.back();
+		if (last_ + head.size() == block.base + block.used &&
+				block.len - block.used >= tailLen) {
+			std::memcpy(block.base + block.used, tail, tailLen);
+			block.used += tailLen;
+			return std::string_view(last_, head.size() + tailLen);
+		}
+	}
+
+	char *data = allocate(head.size() + tailLen);
+	if (data == nullptr)
+		return std::string_view();
+	std::memcpy(data, head.data(), head.size());
+	std::memcpy(data + head.size(), tail, tailLen);
+	return std::string_view(data, head.size() + tailLen);
+}
+
+std::string_view RequestArena::copy(std::string_view data) {
+	return concat(std::string_view(), data.data(), data.size());
+}
+
+bool RequestArena::owns(const char *data) const {
+	for (auto &block : blocks_) {
+		if (data >= block.base && data < block.base + block.len)
+			return true;
+	}
+	return false;
+}
+
+void RequestArena::reset() {
+	while (blocks_.size() > 1) {
+		pool_->release(blocks_.back().base, blocks_.back().len);
+		blocks_.pop_back();
+	}
+	if (!blocks_.empty())
+		blocks_.front().used = 0;
+	last_ = nullptr;
+}
+
+
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++) {
+		char x = a[i], y = b[i];
+		if (x >= 'A' && x <= 'Z')
+			x += 'a' - 'A';
+		if (y >= 'A' && y <= 'Z')
+			y += 'a' - 'A';
+		if (x != y)
+			return false;
+	}
+	return true;
+}
+
+std::string_view HttpHeaders::get(std::string_view name) const {
+	for (size_t i = 0; i < size_; i++) {
+		if (EqualsIgnoreCase(headers_[i].first, name))
+			return headers_[i].second;
+	}
+	return std::string_view();
+}
+
+} // namespace ndcp
@@ -0,0 +1,66 @@
+#ifndef __NDCP_HTTP_HEADERS_H__
+#define __NDCP_HTTP_HEADERS_H__
+#include <stddef.h>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "BufferPool.h"
+
+namespace ndcp {
+
+/*
+ * Bump allocator for the bytes of one request that cannot stay in the read
+ * buffers, i.e. tokens split across two reads. Blocks come from the loop's
+ * BufferPool and the first one is kept across reset(), so steady state
+ * requests don't allocate.
+ */
+class RequestArena {
+public:
+	explicit RequestArena(BufferPool *pool);
+	~RequestArena();
+
+	RequestArena(const RequestArena&) = delete;
+	RequestArena& operator=(const RequestArena&) = delete;
+
+	// Returns nullptr when |size| is larger than the pool's biggest slab.
+	char* allocate(size_t size);
+	// Returns a contiguous copy of |head| followed by |tail|, growing |head|
+	// in place when it is the last allocation.
+	std::string_view concat(std::string_view head, const char *tail, size_t tailLen);
+	std::string_view copy(std::string_view data);
+	bool owns(const char *data) const;
+	void reset();
+
+private:
+	struct Block {
+		char *base;
+		size_t len;
+		size_t used;
+	};
+
+	BufferPool *pool_;
+	std::vector<Block> blocks_;
+	const char *last_ { nullptr };
+};
+
+/* Header table of one request, views into the read buffers or the arena. */
+class HttpHeaders {
+public:
+	static constexpr size_t kMaxHeaders = 64;
+
+	// Case-insensitive lookup, returns an empty view when absent.
+	std::string_view get(std::string_view name) const;
+	size_t size() const { return size_; }
+	std::string_view name(size_t i) const { return headers_[i].first; }
+	std::string_view value(size_t i) const { return headers_[i].second; }
+
+private:
+	friend class HttpConnection;
+
+	std::pair<std::string_view, std::string_view> headers_[kMaxHeaders];
+	size_t size_ { 0 };
+};
+
+} // namespace ndcp
+
+#endif//__NDCP_HTTP_HEADERS_H__
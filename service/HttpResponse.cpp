@@ -0,0 +1,62 @@
+#include "HttpResponse.h"
+
+namespace ndcp {
+
+const char* HttpResponse::statusText(int status) {
+	switch (status) {
+	case 200: return "OK";
+	case 201: return "Created";
+	case 204: return "No Content";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 500: return "Internal Server Error";
+	case 503: return "Service Unavailable";
+	default: return "Unknown";
+	}
+}
+
+HttpResponse::HttpResponse(int status) : status_(status) {
+	head_.reserve(128);
+	head_ += "HTTP/1.1 ";
+	head_ += std::to_string(status);
+	head_ += ' ';
+	head_ += statusText(status);
+	head_ += "\r\n";
+}
+
+HttpResponse& HttpResponse::header(std::string_view name, std::string_view value) {
+	head_.append(name.data(), name.size());
+	head_ += ": ";
+	head_.append(value.data(), value.size());
+	head_ += "\r\n";
+	return *this;
+}
+
+HttpResponse& HttpResponse::body(std::string data) {
+	return body(std::make_shared<const std::string>(std::move(data)));
+}
+
+HttpResponse& HttpResponse::body(std::shared_ptr<const std::string> data) {
+	if (data && !data->empty()) {
+		segments_.push_back({ data->data(), data->size(), data });
+		contentLength_ += data->size();
+	}
+	return *this;
+}
+
+HttpResponse& HttpResponse::bodyRef(const char *data, size_t len) {
+	if (len > 0) {
+		segments_.push_back({ data, len, nullptr });
+		contentLength_ += len;
+	}
+	return *this;
+}
+
+void HttpResponse::finalize(bool keepAlive) {
+	head_ += "Content-Length: ";
+	head_ += std::to_string(contentLength_);
+	head_ += keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+}
+
+} // namespace ndcp
@@ -0,0 +1,61 @@
+#ifndef __NDCP_HTTP_RESPONSE_H__
+#define __NDCP_HTTP_RESPONSE_H__
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ndcp {
+
+/*
+ * A response made of a head (status line and headers) and a list of body
+ * segments. Segments are never copied: HttpConnection hands them to
+ * uv_try_write()/uv_write() as one iovec and keeps their owners alive until
+ * the write completes.
+ */
+class HttpResponse {
+public:
+	/* One body buffer and what keeps it alive, nullptr when borrowed. */
+	struct Segment {
+		const char *data;
+		size_t len;
+		std::shared_ptr<const void> owner;
+	};
+
+	explicit HttpResponse(int status = 200);
+
+	HttpResponse(HttpResponse&&) = default;
+	HttpResponse& operator=(HttpResponse&&) = default;
+
+	// Content-Length and Connection are filled in by the connection.
+	HttpResponse& header(std::string_view name, std::string_view value);
+
+	// Body segments, sent in the order they are added.
+	// Takes ownership of |data|.
+	HttpResponse& body(std::string data);
+	// Shares |data|, e.g. a cached document sent to many clients.
+	HttpResponse& body(std::shared_ptr<const std::string> data);
+	// Borrows |data|, which must outlive the write (static data).
+	HttpResponse& bodyRef(const char *data, size_t len);
+
+	int status() const { return status_; }
+	size_t contentLength() const { return contentLength_; }
+
+	static const char* statusText(int status);
+
+private:
+	friend class HttpConnection;
+
+	// Terminates the head, called once when the response is queued.
+	void finalize(bool keepAlive);
+
+	int status_;
+	std::string head_;
+	std::vector<Segment> segments_;
+	size_t contentLength_ { 0 };
+};
+
+} // namespace ndcp
+
+#endif//__NDCP_HTTP_RESPONSE_H__
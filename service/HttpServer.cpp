@@ -2,35 +2,69 @@
 #include "uv.h"
 #include "Looper.h"
 #include "HttpConnection.h"
+#include "../logger/FlightRecorderSink.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#if !defined(WIN)
+#include <sys/socket.h>
+#endif
 
 namespace ndcp {
 
+static constexpr int kListenBacklog = 511;
+// Bytes of log lines /debug/logs returns by default, and at most.
+static constexpr size_t kDefaultLogLimit = 1024 * 1024;
+static constexpr size_t kMaxLogLimit = 16 * 1024 * 1024;
+
 inline static void onConnection(uv_stream_t *handle, int status) {
-	auto *server = static_cast<HttpServer*>(handle->data);
+	auto *shard = static_cast<HttpServer::LoopShard*>(handle->data);
 
-	if (server == nullptr)
+	if (shard == nullptr || shard->server == nullptr)
 		return;
 
-	server->processNewConnection(handle, status);
+	shard->server->processNewConnection(handle, status);
 }
 
+inline static void onListenerClose(uv_handle_t *handle) {
+	auto *shard = static_cast<HttpServer::LoopShard*>(handle->data);
+	// The connections still point at the shard's context, and its timer
+	// wheel has a handle on the loop.
+	shard->context.connections.whenDrained([shard]() {
+		shard->context.timers.close([shard]() { delete shard; });
+	});
+}
 
-HttpServer::HttpServer() : loop_(Looper::getLooper()) {
 
+HttpServer::HttpServer(int threadCount) : HttpServer(Looper::getMain(), threadCount) {
 }
 
-HttpServer::~HttpServer() {
+HttpServer::HttpServer(Looper *looper, int threadCount) : looper_(looper),
+		threadCount_(threadCount) {
+	if (threadCount_ <= 0) {
+		uv_cpu_info_t *cpus = nullptr;
+		int count = 0;
+		if (uv_cpu_info(&cpus, &count) == 0) {
+			uv_free_cpu_info(cpus, count);
+		}
+		threadCount_ = count > 0 ? count : 1;
+	}
+#if defined(WIN) || !defined(SO_REUSEPORT)
+	if (threadCount_ > 1) {
+		printf("SO_REUSEPORT is not supported, serving on a single loop\n");
+		threadCount_ = 1;
+	}
+#endif
+}
 
+HttpServer::~HttpServer() {
+	stop();
 }
 
 int HttpServer::start(const char *ip, short port) {
 	int err = -1;
 	do {
-		err = uv_tcp_init(loop_, &server_);
-		if (err != 0) {
-			printf("error while initializing tcp server: %s", uv_strerror(err));
-			break;
-		}
 	    struct sockaddr_in addr;
 		err = uv_ip4_addr(ip, port, &addr);
 		if (err!= 0) {
@@ -38,47 +72,287 @@ int HttpServer::start(const char *ip, short port) {
 			break;
 		}
 
-		err = uv_tcp_bind(&server_, (struct sockaddr *) &addr, 0);
+		for (int i = 0; i < threadCount_; i++) {
+			shards_.emplace_back(new LoopShard(readPoolOptions_));
+			LoopShard *shard = shards_.back().get();
+			shard->server = this;
+			shard->index = i;
+			shard->context.router = &router_;
+			shard->context.connections.setCapacity(maxPooledConnections_);
+			shard->context.idleTimeoutMs = idleTimeoutMs_;
+			shard->context.headerTimeoutMs = headerTimeoutMs_;
+			shard->context.maxPipelined = maxPipelined_;
+			if (i == 0) {
+				shard->looper = looper_;
+				shard->context.looper = looper_;
+				err = startShard(shard, (struct sockaddr *) &addr);
+			} else {
+				shard->ownedLooper.reset(new Looper);
+				shard->looper = shard->ownedLooper.get();
+				shard->context.looper = shard->looper;
+				// The listener is set up on the thread of its loop.
+				char name[16];
+				snprintf(name, sizeof(name), "http-%d", i);
+				err = shard->looper->start(name, [this, shard, &addr]() {
+					if (monitorLoops_)
+						shard->looper->startMonitor(monitorOptions_);
+					if (watchLoops_)
+						shard->looper->startWatchdog(watchdogOptions_);
+					return startShard(shard, (struct sockaddr *) &addr);
+				});
+				if (err != 0)
+					printf("error while starting loop %d: %s\n", i, uv_strerror(err));
+			}
+			if (err != 0)
+				break;
+		}
+		if (err != 0) {
+			stop();
+			break;
+		}
+	} while (0);
+
+	return err;
+}
+
+int HttpServer::startShard(LoopShard *shard, const struct sockaddr *addr) {
+	int err = -1;
+	do {
+		err = uv_tcp_init_ex(shard->looper->getLoop(), &shard->listener, AF_INET);
+		if (err != 0) {
+			printf("error while initializing tcp server: %s", uv_strerror(err));
+			break;
+		}
+		shard->listener.data = shard;
+		shard->listenerInited = true;
+
+		err = shard->context.timers.init(shard->looper->getLoop());
+		if (err != 0)
+			break;
+
+#if !defined(WIN) && defined(SO_REUSEPORT)
+		if (threadCount_ > 1) {
+			uv_os_fd_t fd;
+			int on = 1;
+			err = uv_fileno(reinterpret_cast<uv_handle_t*>(&shard->listener), &fd);
+			if (err == 0 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+				err = uv_translate_sys_error(errno);
+			if (err != 0) {
+				printf("error while enabling SO_REUSEPORT: %s", uv_strerror(err));
+				break;
+			}
+		}
+#endif
+
+		err = uv_tcp_bind(&shard->listener, addr, 0);
 		if (err != 0) {
 			printf("error while binding addr: %s", uv_strerror(err));
 			break;
 		}
-		server_.data = this;
-		err = uv_listen(reinterpret_cast<uv_stream_t*>(&server_), 3, static_cast<uv_connection_cb>(onConnection));
-		err = 0;
+		err = uv_listen(reinterpret_cast<uv_stream_t*>(&shard->listener), kListenBacklog,
+				static_cast<uv_connection_cb>(onConnection));
+		if (err != 0) {
+			printf("error while listening: %s", uv_strerror(err));
+			break;
+		}
 	} while (0);
 
 	return err;
 }
 
+int HttpServer::stop() {
+	for (auto &shard : shards_) {
+		{
+			// Responders don't get through from now on.
+			HttpResponderTarget *target = shard->context.responderTarget.get();
+			std::lock_guard<std::mutex> _(target->mutex);
+			target->context = nullptr;
+		}
+		if (shard->ownedLooper) {
+			// The connections go back to the pool, which frees them with the
+			// shard. Stopping the Looper closes what is left on the loop.
+			LoopShard *owned = shard.get();
+			shard->looper->post([owned]() {
+				owned->server = nullptr;
+				owned->context.connections.closeAll();
+			});
+			shard->looper->stop();
+		} else if (shard->listenerInited) {
+			// The Looper loop keeps running, the shard goes away with its
+			// listener and connections.
+			shard->server = nullptr;
+			shard->context.connections.closeAll();
+			uv_close(reinterpret_cast<uv_handle_t*>(&shard->listener),
+					static_cast<uv_close_cb>(onListenerClose));
+			shard.release();
+		}
+	}
+	shards_.clear();
+	return 0;
+}
+
 int HttpServer::processNewConnection(uv_stream_t *handle, int status) {
+	auto *shard = static_cast<LoopShard*>(handle->data);
 	if (status != 0) {
 		printf("error while receiving a new TCP connection: %s\n",
 				uv_strerror(status));
+		shard->acceptErrors.fetch_add(1, std::memory_order_relaxed);
 
 		return -1;
 	}
 	int err;
-    HttpConnection* connection = new HttpConnection;
-    uv_tcp_init(loop_, connection->GetHandle());
-    connection->GetHandle()->data = connection;
+	HttpConnection* connection = shard->context.connections.acquire(&shard->context);
+	uv_tcp_init(handle->loop, connection->GetHandle());
+	connection->GetHandle()->data = connection;
 
 	// Accept the connection.
-	err = uv_accept(reinterpret_cast<uv_stream_t*>(&server_),
+	err = uv_accept(handle,
 			reinterpret_cast<uv_stream_t*>(connection->GetHandle()));
 
 	if (err != 0) {
 		printf("error while accepting the new connection: %s", uv_strerror(err));
+		shard->acceptErrors.fetch_add(1, std::memory_order_relaxed);
+		// Closing hands the connection back to the pool.
+		connection->Abort();
 		return -1;
 	}
 
+	shard->accepted.fetch_add(1, std::memory_order_relaxed);
 	connection->Start();
 	return 0;
 
 }
 
+Router& HttpServer::router() {
+	return router_;
+}
+
+/* Parses the /debug/logs query, see addLogEndpoint(). */
+static bool parseLogQuery(std::string_view query, tuya::LoggingSeverity *severity,
+		int64_t *sinceUs, int64_t *untilUs, size_t *limit) {
+	static const char *const kSeverities[] = { "verbose", "info", "warning", "error" };
+	while (!query.empty()) {
+		size_t amp = query.find('&');
+		std::string_view pair = query.substr(0, amp);
+		query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
 
+		size_t eq = pair.find('=');
+		if (eq == std::string_view::npos)
+			continue;
+		std::string_view name = pair.substr(0, eq);
+		std::string value(pair.substr(eq + 1));
+		char *end = nullptr;
+		errno = 0;
+		long long number = strtoll(value.c_str(), &end, 10);
+		bool isNumber = !value.empty() && *end == '\0' && errno != ERANGE;
 
-} //namespace oscp
+		if (name == "severity") {
+			int found = -1;
+			for (int i = 0; i < 4; i++) {
+				if (value == kSeverities[i] || (isNumber && number == i))
+					found = i;
+			}
+			if (found < 0)
+				return false;
+			*severity = static_cast<tuya::LoggingSeverity>(found);
+		} else if (!isNumber || number < 0) {
+			return false;
+		} else if (name == "since") {
+			// Out of range once in microseconds.
+			if (number > INT64_MAX / 1000)
+				return false;
+			*sinceUs = number * 1000;
+		} else if (name == "until") {
+			if (number > INT64_MAX / 1000)
+				return false;
+			*untilUs = number * 1000;
+		} else if (name == "last") {
+			if (number > INT64_MAX / 1000000)
+				return false;
+			int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+			*sinceUs = nowUs - number * 1000000;
+		} else if (name == "limit") {
+			*limit = std::min(static_cast<size_t>(number), kMaxLogLimit);
+		}
+	}
+	return true;
+}
 
+int HttpServer::addLogEndpoint(tuya::FlightRecorderSink *recorder,
+		const std::string &path) {
+	return router_.add(HTTP_GET, path, [recorder](HttpConnection *connection,
+			const HttpRequest &request) {
+		tuya::LoggingSeverity severity = tuya::LS_VERBOSE;
+		int64_t sinceUs = 0;
+		int64_t untilUs = INT64_MAX;
+		size_t limit = kDefaultLogLimit;
+		if (!parseLogQuery(request.query, &severity, &sinceUs, &untilUs, &limit)) {
+			connection->WriteResponse(request.seq, 400, "Bad Request\n");
+			return;
+		}
 
+		std::string lines;
+		recorder->Dump(severity, sinceUs, untilUs, &lines, limit);
+		HttpResponse response(200);
+		response.header("Content-Type", "text/plain; charset=utf-8");
+		response.header("Cache-Control", "no-store");
+		response.body(std::move(lines));
+		connection->SendResponse(request.seq, std::move(response));
+	});
+}
+
+void HttpServer::setReadPoolOptions(const BufferPool::Options &options) {
+	readPoolOptions_ = options;
+}
+
+void HttpServer::setLoopMonitor(const LoopMonitor::Options &options) {
+	monitorLoops_ = true;
+	monitorOptions_ = options;
+}
+
+void HttpServer::setLoopWatchdog(const LoopWatchdog::Options &options) {
+	watchLoops_ = true;
+	watchdogOptions_ = options;
+}
+
+void HttpServer::setTimeouts(uint64_t idleTimeoutMs, uint64_t headerTimeoutMs) {
+	idleTimeoutMs_ = idleTimeoutMs;
+	headerTimeoutMs_ = headerTimeoutMs;
+}
+
+void HttpServer::setMaxPooledConnections(size_t maxPooled) {
+	maxPooledConnections_ = maxPooled;
+}
+
+void HttpServer::setMaxPipelined(size_t maxPipelined) {
+	maxPipelined_ = maxPipelined;
+}
+
+int HttpServer::getThreadCount() const {
+	return threadCount_;
+}
+
+// Relaxed reads of counters the loops keep writing: each is current, but
+// they are not a consistent snapshot of one another.
+std::vector<HttpServer::LoopStats> HttpServer::getLoopStats() const {
+	std::vector<LoopStats> stats;
+	for (auto &shard : shards_) {
+		stats.push_back({ shard->index,
+				shard->accepted.load(std::memory_order_relaxed),
+				shard->acceptErrors.load(std::memory_order_relaxed),
+				shard->context.headerStraddles.load(std::memory_order_relaxed),
+				shard->context.idleTimeouts.load(std::memory_order_relaxed),
+				shard->context.headerTimeouts.load(std::memory_order_relaxed),
+				shard->context.connections.live(),
+				shard->context.connections.pooled(),
+				shard->context.connections.created(),
+				shard->context.readPool.getStats(),
+				shard->looper->getMonitorStats() });
+	}
+	return stats;
+}
+
+
+
+} //namespace oscp
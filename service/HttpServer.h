@@ -1,25 +1,130 @@
 #ifndef __NSCP_HTTP_SERVER_H__
 #define __NSCP_HTTP_SERVER_H__
+#include <atomic>
+#include <memory>
+#include <vector>
 #include "uv.h"
 #include "http-parser/http_parser.h"
+#include "BufferPool.h"
+#include "HttpConnection.h"
+#include "Looper.h"
+#include "Router.h"
+
+namespace tuya {
+class FlightRecorderSink;
+}
+
 namespace ndcp {
 
 class HttpServer {
 public:
-	HttpServer();
+	/* Snapshot of the counters kept by one accept loop. */
+	struct LoopStats {
+		int index;
+		uint64_t accepted;
+		uint64_t acceptErrors;
+		uint64_t headerStraddles;
+		uint64_t idleTimeouts;
+		uint64_t headerTimeouts;
+		uint64_t liveConnections;
+		uint64_t pooledConnections;
+		uint64_t createdConnections;
+		BufferPool::Stats readPool;
+		// Zero unless the Looper of the loop has its monitor on.
+		LoopMonitor::Stats looper;
+	};
+
+	// |threadCount| is the number of event loops serving the port. Loop 0 is
+	// |looper|, every other loop is a Looper of its own, with its own thread
+	// and its own SO_REUSEPORT listener so the kernel spreads incoming
+	// connections across them. 0 means one loop per CPU.
+	explicit HttpServer(Looper *looper, int threadCount = 1);
+	// Serves on the main Looper.
+	explicit HttpServer(int threadCount = 1);
+	// Stops if still serving, see stop().
 	~HttpServer();
 
+	// Both, and the destructor, must be called from the thread of |looper|.
 	int start(const char *addr, short port);
 	int stop();
 
 	int processNewConnection(uv_stream_t *handle, int status);
+
+	// Routes must be registered before start(), the table is shared read
+	// only by every loop.
+	Router& router();
+
+	// Sizing of the per-loop read buffer pools, must be set before start().
+	void setReadPoolOptions(const BufferPool::Options &options);
+
+	// Closed connections each loop keeps for reuse, must be set before start().
+	void setMaxPooledConnections(size_t maxPooled);
+
+	// Pipelined requests a connection may have waiting for their response
+	// before the server stops reading from it, 0 for no limit. Must be set
+	// before start().
+	void setMaxPipelined(size_t maxPipelined);
+
+	// Turns on the LoopMonitor of the loops the server starts, must be set
+	// before start(). Loop 0 belongs to the caller, which decides for it.
+	void setLoopMonitor(const LoopMonitor::Options &options);
+	// Same for their LoopWatchdog.
+	void setLoopWatchdog(const LoopWatchdog::Options &options);
+
+	// Connection idle timeout and request header deadline in ms, 0 disables
+	// either. Must be set before start().
+	void setTimeouts(uint64_t idleTimeoutMs, uint64_t headerTimeoutMs);
+
+	// Serves the lines held by |recorder| as text at |path|, oldest first.
+	// Query parameters, all optional:
+	//   severity=verbose|info|warning|error   lowest severity, or its number
+	//   since=<ms> until=<ms>                 milliseconds since the epoch
+	//   last=<s>                              only the last s seconds
+	//   limit=<bytes>                         the newest lines that fit, 1 MB
+	//                                         by default and 16 MB at most
+	// Must be called before start(), |recorder| must outlive the server.
+	int addLogEndpoint(tuya::FlightRecorderSink *recorder,
+			const std::string &path = "/debug/logs");
+
+	int getThreadCount() const;
+	std::vector<LoopStats> getLoopStats() const;
+
 public:
+	/* One listener and the loop it accepts on. */
+	struct LoopShard {
+		explicit LoopShard(const BufferPool::Options &options) : context(options) {}
+
+		HttpServer *server { nullptr };
+		int index { 0 };
+		Looper *looper { nullptr };
+		bool listenerInited { false };
+		uv_tcp_t listener;
+		std::atomic<uint64_t> accepted { 0 };
+		std::atomic<uint64_t> acceptErrors { 0 };
+		HttpLoopContext context;
+		// Set for the loops other than loop 0. Declared last, so its thread
+		// is joined before the state it works on goes away.
+		std::unique_ptr<Looper> ownedLooper;
+	};
 
+private:
+	int startShard(LoopShard *shard, const struct sockaddr *addr);
 
 private:
 
-	uv_loop_t *loop_;
-	uv_tcp_t server_;
+	Looper *looper_;
+	int threadCount_;
+	BufferPool::Options readPoolOptions_;
+	Router router_;
+	size_t maxPooledConnections_ { 1024 };
+	size_t maxPipelined_ { 16 };
+	uint64_t idleTimeoutMs_ { 60000 };
+	uint64_t headerTimeoutMs_ { 10000 };
+	bool monitorLoops_ { false };
+	LoopMonitor::Options monitorOptions_;
+	bool watchLoops_ { false };
+	LoopWatchdog::Options watchdogOptions_;
+	std::vector<std::unique_ptr<LoopShard>> shards_;
 
 
 };
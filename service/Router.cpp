@@ -0,0 +1,195 @@
+#include "Router.h"
+#include <stdio.h>
+
+namespace ndcp {
+
+std::string_view RouteParams::get(std::string_view name) const {
+	for (size_t i = 0; i < size_; i++) {
+		if (params_[i].first == name)
+			return params_[i].second;
+	}
+	return std::string_view();
+}
+
+bool RouteParams::push(std::string_view name, std::string_view value) {
+	if (size_ == kMaxParams)
+		return false;
+	params_[size_++] = { name, value };
+	return true;
+}
+
+
+Router::Router() : root_(new Node) {
+
+}
+
+Router::~Router() {
+
+}
+
+int Router::add(http_method method, const std::string &pattern, RouteHandler handler) {
+	if (pattern.empty() || pattern[0] != '/' || !handler) {
+		printf("invalid route pattern: %s\n", pattern.c_str());
+		return -1;
+	}
+
+	Node *node = root_.get();
+	std::string_view rest(pattern);
+	size_t params = 0;
+	while (!rest.empty()) {
+		if (rest[0] == ':') {
+			size_t end = rest.find('/');
+			std::string_view name = rest.substr(1, end == std::string_view::npos ?
+					std::string_view::npos : end - 1);
+			if (name.empty() || ++params > RouteParams::kMaxParams) {
+				printf("invalid route parameter in %s\n", pattern.c_str());
+				return -1;
+			}
+			if (!node->paramChild) {
+				node->paramChild.reset(new Node);
+				node->paramName = std::string(name);
+			} else if (node->paramName != name) {
+				printf("route %s conflicts with parameter :%s\n", pattern.c_str(),
+						node->paramName.c_str());
+				return -1;
+			}
+			node = node->paramChild.get();
+			rest = end == std::string_view::npos ? std::string_view() : rest.substr(end);
+		} else if (rest[0] == '*') {
+			std::string_view name = rest.substr(1);
+			if (name.empty() || name.find('/') != std::string_view::npos ||
+					++params > RouteParams::kMaxParams) {
+				printf("wildcard must be the last segment of %s\n", pattern.c_str());
+				return -1;
+			}
+			if (!node->wildcardChild) {
+				node->wildcardChild.reset(new Node);
+				node->wildcardName = std::string(name);
+			} else if (node->wildcardName != name) {
+				printf("route %s conflicts with wildcard *%s\n", pattern.c_str(),
+						node->wildcardName.c_str());
+				return -1;
+			}
+			node = node->wildcardChild.get();
+			rest = std::string_view();
+		} else {
+			size_t end = rest.find_first_of(":*");
+			std::string_view literal = rest.substr(0, end);
+			node = insertStatic(node, literal);
+			rest = end == std::string_view::npos ? std::string_view() : rest.substr(end);
+		}
+	}
+
+	if (node->handlers.size() <= static_cast<size_t>(method))
+		node->handlers.resize(method + 1);
+	if (node->handlers[method]) {
+		printf("duplicate route %s %s\n", http_method_str(method), pattern.c_str());
+		return -1;
+	}
+	node->handlers[method] = std::move(handler);
+	routes_++;
+	return 0;
+}
+
+Router::Node* Router::insertStatic(Node *node, std::string_view literal) {
+	while (!literal.empty()) {
+		size_t i = node->indices.find(literal[0]);
+		if (i == std::string::npos) {
+			std::unique_ptr<Node> child(new Node);
+			child->prefix = std::string(literal);
+			node->indices.push_back(literal[0]);
+			node->children.push_back(std::move(child));
+			return node->children.back().get();
+		}
+
+		Node *child = node->children[i].get();
+		size_t common = 0;
+		while (common < child->prefix.size() && common < literal.size() &&
+				child->prefix[common] == literal[common])
+			common++;
+
+		if (common < child->prefix.size()) {
+			// Split the edge: the shared part becomes a new inner node.
+			std::unique_ptr<Node> mid(new Node);
+			mid->prefix = child->prefix.substr(0, common);
+			child->prefix.erase(0, common);
+			mid->indices.push_back(child->prefix[0]);
+			mid->children.push_back(std::move(node->children[i]));
+			node->children[i] = std::move(mid);
+			child = node->children[i].get();
+		}
+		node = child;
+		literal.remove_prefix(common);
+	}
+	return node;
+}
+
+bool Router::hasHandlers(const Node *node) {
+	for (auto &handler : node->handlers) {
+		if (handler)
+			return true;
+	}
+	return false;
+}
+
+bool Router::accepts(const Node *node, http_method method, bool *pathMatched) {
+	if (!hasHandlers(node))
+		return false;
+	*pathMatched = true;
+	return node->handlers.size() > static_cast<size_t>(method) &&
+			node->handlers[method];
+}
+
+const Router::Node* Router::lookup(const Node *node, http_method method,
+		std::string_view path, RouteParams *params, bool *pathMatched) const {
+	if (path.empty()) {
+		if (accepts(node, method, pathMatched))
+			return node;
+		// "/files/*path" also matches "/files/".
+		if (node->wildcardChild && accepts(node->wildcardChild.get(), method, pathMatched) &&
+				params->push(node->wildcardName, path))
+			return node->wildcardChild.get();
+		return nullptr;
+	}
+
+	size_t i = node->indices.find(path[0]);
+	if (i != std::string::npos) {
+		const Node *child = node->children[i].get();
+		if (path.compare(0, child->prefix.size(), child->prefix) == 0) {
+			const Node *found = lookup(child, method, path.substr(child->prefix.size()),
+					params, pathMatched);
+			if (found)
+				return found;
+		}
+	}
+
+	if (node->paramChild) {
+		size_t end = path.find('/');
+		std::string_view segment = path.substr(0, end);
+		if (!segment.empty() && params->push(node->paramName, segment)) {
+			const Node *found = lookup(node->paramChild.get(), method,
+					end == std::string_view::npos ? std::string_view() : path.substr(end),
+					params, pathMatched);
+			if (found)
+				return found;
+			params->pop();
+		}
+	}
+
+	if (node->wildcardChild && accepts(node->wildcardChild.get(), method, pathMatched) &&
+			params->push(node->wildcardName, path))
+		return node->wildcardChild.get();
+
+	return nullptr;
+}
+
+const RouteHandler* Router::match(http_method method, std::string_view path,
+		RouteParams *params, bool *pathMatched) const {
+	bool matched = false;
+	const Node *node = lookup(root_.get(), method, path, params, &matched);
+	if (pathMatched)
+		*pathMatched = matched;
+	return node ? &node->handlers[method] : nullptr;
+}
+
+} // namespace ndcp
@@ -0,0 +1,111 @@
+#ifndef __NDCP_ROUTER_H__
+#define __NDCP_ROUTER_H__
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "http-parser/http_parser.h"
+#include "HttpHeaders.h"
+
+namespace ndcp {
+
+class HttpConnection;
+
+/* Path parameters of a matched route, views into the route table and URL. */
+class RouteParams {
+public:
+	static constexpr size_t kMaxParams = 8;
+
+	// Returns an empty view when |name| is not a parameter of the route.
+	std::string_view get(std::string_view name) const;
+	size_t size() const { return size_; }
+	std::string_view name(size_t i) const { return params_[i].first; }
+	std::string_view value(size_t i) const { return params_[i].second; }
+
+private:
+	friend class Router;
+	bool push(std::string_view name, std::string_view value);
+	void pop() { size_--; }
+
+	std::pair<std::string_view, std::string_view> params_[kMaxParams];
+	size_t size_ { 0 };
+};
+
+/* What a route handler gets to see of a request, valid during the call. */
+struct HttpRequest {
+	uint64_t seq;
+	http_method method;
+	std::string_view path;
+	std::string_view query;
+	std::string_view body;
+	const HttpHeaders *headers;
+	RouteParams params;
+};
+
+using RouteHandler = std::function<void(HttpConnection *connection,
+		const HttpRequest &request)>;
+
+// Method + path router backed by a compressed radix tree, so a lookup costs
+// O(path length) whatever the number of routes.
+//
+// Patterns are literal paths with optional segments:
+//   /users/:id          ":name" matches one path segment
+//   /static/*file       "*name" matches the rest of the path, must be last
+// Literal children win over parameters, parameters over wildcards, among the
+// routes that have a handler for the method of the request: a POST to
+// /users/me reaches POST /users/:id even when GET /users/me exists.
+//
+// Routes are added before the server starts; lookups are read only and may
+// run concurrently from every loop.
+class Router {
+public:
+	Router();
+	~Router();
+
+	Router(const Router&) = delete;
+	Router& operator=(const Router&) = delete;
+
+	// Returns 0, or -1 when |pattern| is malformed or conflicts with an
+	// existing route.
+	int add(http_method method, const std::string &pattern, RouteHandler handler);
+
+	// Returns the handler for |method| and |path| and fills |params|, or
+	// nullptr. |pathMatched| tells 405 from 404 when no handler is returned:
+	// it is set when some route matches |path| for another method.
+	const RouteHandler* match(http_method method, std::string_view path,
+			RouteParams *params, bool *pathMatched = nullptr) const;
+
+	size_t size() const { return routes_; }
+
+private:
+	struct Node {
+		std::string prefix;
+		// First byte of each static child's prefix, same order as children.
+		std::string indices;
+		std::vector<std::unique_ptr<Node>> children;
+		std::string paramName;
+		std::unique_ptr<Node> paramChild;
+		std::string wildcardName;
+		std::unique_ptr<Node> wildcardChild;
+		// Indexed by http_method.
+		std::vector<RouteHandler> handlers;
+	};
+
+	Node* insertStatic(Node *node, std::string_view literal);
+	// Backtracks until a node matching the whole path has a handler for
+	// |method|, setting |pathMatched| on the way if one has any handler.
+	const Node* lookup(const Node *node, http_method method, std::string_view path,
+			RouteParams *params, bool *pathMatched) const;
+	static bool hasHandlers(const Node *node);
+	static bool accepts(const Node *node, http_method method, bool *pathMatched);
+
+private:
+	std::unique_ptr<Node> root_;
+	size_t routes_ { 0 };
+};
+
+} // namespace ndcp
+
+#endif//__NDCP_ROUTER_H__
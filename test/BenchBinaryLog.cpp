@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "../logger/BinaryLog.h"
+#include "../logger/Logging.h"
+#include "../uvkits/Looper.h"
+
+// Call-site cost and output size of binary versus text logging for a run of
+// typical request lines, then decodes the binary log back to check it
+// renders the same text.
+class CountingSink : public tuya::LogSink {
+ public:
+  void OnLogMessage(const std::string& message) override {
+    bytes_ += message.size();
+  }
+  uint64_t bytes_ = 0;
+};
+
+static const char* const kPaths[] = {"/", "/users/42", "/static/app.js"};
+
+int main(int argc, char* argv[]) {
+  const int count = argc > 1 ? atoi(argv[1]) : 200000;
+  const char* path = argc > 2 ? argv[2] : "/tmp/bench.blog";
+
+  CountingSink sink;
+  tuya::LogMessage::LogToDebug(tuya::LS_NONE);
+  tuya::LogMessage::LogTimestamps(true);
+  tuya::LogMessage::LogThreads(true);
+  tuya::LogMessage::AddLogToStream(&sink, tuya::LS_INFO);
+
+  uint64_t start = ndcp::Looper::getTimeNs();
+  for (int i = 0; i < count; i++) {
+    tuya::LogMessage(__FILE__, __LINE__, tuya::LS_INFO).stream()
+        << "GET " << kPaths[i % 3] << " 200 " << 512 + i % 4096
+        << " bytes in " << 0.25 * (i % 100) << " ms, conn " << i / 8;
+  }
+  double textNs = static_cast<double>(ndcp::Looper::getTimeNs() - start) / count;
+  tuya::LogMessage::RemoveLogToStream(&sink);
+
+  if (!tuya::BinaryLog::Start(path, tuya::LS_INFO)) {
+    perror(path);
+    return 1;
+  }
+  start = ndcp::Looper::getTimeNs();
+  for (int i = 0; i < count; i++) {
+    BLOGI << BINLOG_LIT("GET ") << kPaths[i % 3] << BINLOG_LIT(" 200 ")
+          << 512 + i % 4096 << BINLOG_LIT(" bytes in ") << 0.25 * (i % 100)
+          << BINLOG_LIT(" ms, conn ") << i / 8;
+  }
+  double binaryNs = static_cast<double>(ndcp::Looper::getTimeNs() - start) / count;
+  tuya::BinaryLog::Flush();
+  uint64_t binaryBytes = tuya::BinaryLog::BytesWritten();
+  tuya::BinaryLog::Stop();
+
+  FILE* file = fopen(path, "rb");
+  std::string data;
+  char buf[64 * 1024];
+  size_t n;
+  while (file && (n = fread(buf, 1, sizeof(buf), file)) > 0)
+    data.append(buf, n);
+  if (file)
+    fclose(file);
+  std::string text;
+  start = ndcp::Looper::getTimeNs();
+  bool ok = tuya::BinaryLog::Decode(data.data(), data.size(), &text);
+  double decodeNs = static_cast<double>(ndcp::Looper::getTimeNs() - start) / count;
+
+  printf("text:   %.0f ns/line, %llu bytes\n", textNs,
+         static_cast<unsigned long long>(sink.bytes_));
+  printf("binary: %.0f ns/line, %llu bytes (%.1fx smaller)\n", binaryNs,
+         static_cast<unsigned long long>(binaryBytes),
+         binaryBytes ? static_cast<double>(sink.bytes_) / binaryBytes : 0.0);
+  printf("decode: %.0f ns/line, %zu text bytes%s\n", decodeNs, text.size(),
+         ok ? "" : ", MALFORMED");
+  return ok ? 0 : 1;
+}
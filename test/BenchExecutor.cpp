@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../uvkits/Executor.h"
+#include "../uvkits/Looper.h"
+
+// Executor against uv_queue_work, both with the same number of threads.
+//  - burst: many tiny tasks, then a few large ones, all submitted at once
+//    by the loop thread. Reports throughput; the latencies are mostly time
+//    queued behind the burst.
+//  - paced: tiny tasks submitted one at a time on the loop at a fixed rate
+//    well below saturation. Reports the latency of one task, from
+//    submission to the completion callback on the loop.
+static uint64_t burn(uint64_t rounds) {
+  uint64_t x = 88172645463325252ull + rounds;
+  for (uint64_t i = 0; i < rounds; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+  }
+  return x;
+}
+
+// Keeps the work from being optimized out.
+static std::atomic<uint64_t> sink;
+
+static void work(uint64_t rounds) {
+  sink.store(burn(rounds), std::memory_order_relaxed);
+}
+
+// Rounds of burn() taking about |ns|.
+static uint64_t calibrate(uint64_t ns) {
+  const uint64_t rounds = 10000000;
+  uint64_t start = ndcp::Looper::getTimeNs();
+  work(rounds);
+  double perRound = static_cast<double>(ndcp::Looper::getTimeNs() - start) / rounds;
+  return std::max<uint64_t>(1, static_cast<uint64_t>(ns / perRound));
+}
+
+struct Run {
+  std::vector<uint64_t> latencies;
+  uint64_t start;
+  // Paced runs: keeps the loop up until |expected| tasks completed.
+  uv_timer_t* keepAlive = nullptr;
+  size_t expected = 0;
+};
+
+static void complete(Run* run, uint64_t submitted) {
+  run->latencies.push_back(ndcp::Looper::getTimeNs() - submitted);
+  if (run->keepAlive && run->latencies.size() == run->expected)
+    uv_timer_stop(run->keepAlive);
+}
+
+static void report(const char* backend, const char* workload, Run& run) {
+  double seconds = (ndcp::Looper::getTimeNs() - run.start) / 1e9;
+  std::sort(run.latencies.begin(), run.latencies.end());
+  auto percentile = [&](double q) {
+    return run.latencies[static_cast<size_t>(q * (run.latencies.size() - 1))] / 1000.0;
+  };
+  printf("%-14s %-6s %8zu tasks %10.0f tasks/s  latency us p50 %9.1f p99 %9.1f max %9.1f\n",
+         backend, workload, run.latencies.size(), run.latencies.size() / seconds,
+         percentile(0.5), percentile(0.99), percentile(1.0));
+}
+
+// Calls |submit| on the loop every |gapUs|, |count| times, and runs the
+// loop until every task completed.
+static void runPaced(Run* run, size_t count, int gapUs,
+                     const std::function<void(Run*)>& submit) {
+  uv_timer_t keepAlive;
+  uv_timer_init(ndcp::Looper::getLooper(), &keepAlive);
+  uv_timer_start(&keepAlive, [](uv_timer_t*) {}, 1000, 1000);
+  run->latencies.reserve(count);
+  run->keepAlive = &keepAlive;
+  run->expected = count;
+  run->start = ndcp::Looper::getTimeNs();
+
+  std::thread pacer([&]() {
+    auto next = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+      next += std::chrono::microseconds(gapUs);
+      std::this_thread::sleep_until(next);
+      ndcp::Looper::postTask([run, &submit]() { submit(run); });
+    }
+  });
+  ndcp::Looper::loop();
+  pacer.join();
+
+  uv_close(reinterpret_cast<uv_handle_t*>(&keepAlive), nullptr);
+  uv_run(ndcp::Looper::getLooper(), UV_RUN_NOWAIT);
+}
+
+static void benchExecutor(ndcp::Executor& executor, const char* workload,
+                          size_t count, uint64_t rounds) {
+  Run run;
+  run.latencies.reserve(count);
+  run.start = ndcp::Looper::getTimeNs();
+  for (size_t i = 0; i < count; i++) {
+    uint64_t submitted = ndcp::Looper::getTimeNs();
+    executor.submit([rounds]() { work(rounds); },
+                    [&run, submitted]() { complete(&run, submitted); });
+  }
+  ndcp::Looper::loop();
+  report("executor", workload, run);
+}
+
+struct WorkRequest {
+  uv_work_t req;
+  uint64_t submitted;
+  uint64_t rounds;
+  Run* run;
+};
+
+static void queueWork(WorkRequest* request, uint64_t rounds, Run* run) {
+  request->req.data = request;
+  request->submitted = ndcp::Looper::getTimeNs();
+  request->rounds = rounds;
+  request->run = run;
+  uv_queue_work(ndcp::Looper::getLooper(), &request->req,
+      [](uv_work_t* req) {
+        work(static_cast<WorkRequest*>(req->data)->rounds);
+      },
+      [](uv_work_t* req, int) {
+        auto* request = static_cast<WorkRequest*>(req->data);
+        complete(request->run, request->submitted);
+      });
+}
+
+static void benchQueueWork(const char* workload, size_t count, uint64_t rounds) {
+  Run run;
+  run.latencies.reserve(count);
+  std::vector<WorkRequest> requests(count);
+  run.start = ndcp::Looper::getTimeNs();
+  for (auto& request : requests)
+    queueWork(&request, rounds, &run);
+  ndcp::Looper::loop();
+  report("uv_queue_work", workload, run);
+}
+
+static void benchPaced(ndcp::Executor& executor, size_t count, uint64_t rounds,
+                       int gapUs) {
+  Run executorRun;
+  runPaced(&executorRun, count, gapUs, [&executor, rounds](Run* run) {
+    uint64_t submitted = ndcp::Looper::getTimeNs();
+    executor.submit([rounds]() { work(rounds); },
+                    [run, submitted]() { complete(run, submitted); });
+  });
+  report("executor", "paced", executorRun);
+
+  Run queueRun;
+  std::vector<WorkRequest> requests(count);
+  size_t next = 0;
+  runPaced(&queueRun, count, gapUs, [&](Run* run) {
+    queueWork(&requests[next++], rounds, run);
+  });
+  report("uv_queue_work", "paced", queueRun);
+}
+
+int main(int argc, char* argv[]) {
+  const int threads = argc > 1 ? atoi(argv[1]) : 4;
+  const size_t tinyCount = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200000;
+  const size_t largeCount = argc > 3 ? strtoul(argv[3], nullptr, 10) : 64;
+  const size_t pacedCount = argc > 4 ? strtoul(argv[4], nullptr, 10) : 5000;
+  const int pacedGapUs = argc > 5 ? atoi(argv[5]) : 200;
+
+  // Before the first uv_queue_work(), which sizes the pool.
+  setenv("UV_THREADPOOL_SIZE", std::to_string(threads).c_str(), 1);
+  ndcp::Looper::init();
+
+  const uint64_t tinyRounds = calibrate(500);
+  const uint64_t largeRounds = calibrate(10000000);
+  printf("%d threads; tiny tasks ~0.5 us, large tasks ~10 ms of work, "
+         "paced tiny tasks %d us apart\n", threads, pacedGapUs);
+
+  ndcp::Executor::Options options;
+  options.threads = threads;
+  ndcp::Executor executor(options);
+  executor.start();
+
+  benchExecutor(executor, "tiny", tinyCount, tinyRounds);
+  benchQueueWork("tiny", tinyCount, tinyRounds);
+  benchExecutor(executor, "large", largeCount, largeRounds);
+  benchQueueWork("large", largeCount, largeRounds);
+  benchPaced(executor, pacedCount, tinyRounds, pacedGapUs);
+
+  ndcp::Executor::Stats stats = executor.getStats();
+  printf("executor: %llu executed, %llu stolen, %llu parks\n",
+         static_cast<unsigned long long>(stats.executed),
+         static_cast<unsigned long long>(stats.stolen),
+         static_cast<unsigned long long>(stats.parks));
+  executor.stop();
+  ndcp::Looper::destory();
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "../logger/Logging.h"
+#include "../uvkits/Looper.h"
+
+// Sink fan-out under contention: many threads log to the same sinks while
+// another thread keeps adding and removing a sink. Reports the throughput
+// and checks that a removed sink is never called.
+class CountingSink : public tuya::LogSink {
+ public:
+  void OnLogMessage(const std::string& /*message*/) override {
+    if (removed_.load(std::memory_order_relaxed))
+      lateCalls_.fetch_add(1, std::memory_order_relaxed);
+    calls_.fetch_add(1, std::memory_order_relaxed);
+  }
+  std::atomic<bool> removed_{false};
+  std::atomic<uint64_t> calls_{0};
+  std::atomic<uint64_t> lateCalls_{0};
+};
+
+// With |churn|, the workers keep logging until the churner has added and
+// removed it |swaps| times, so every swap races the loggers.
+static double run(int threads, int lines, CountingSink* churn, int swaps) {
+  std::atomic<bool> churning{churn != nullptr};
+  std::thread churner;
+  if (churn) {
+    churner = std::thread([&] {
+      for (int i = 0; i < swaps; i++) {
+        churn->removed_.store(false, std::memory_order_relaxed);
+        tuya::LogMessage::AddLogToStream(churn, tuya::LS_INFO);
+        std::this_thread::yield();
+        tuya::LogMessage::RemoveLogToStream(churn);
+        churn->removed_.store(true, std::memory_order_relaxed);
+      }
+      churning.store(false, std::memory_order_relaxed);
+    });
+  }
+
+  std::atomic<uint64_t> logged{0};
+  std::vector<std::thread> workers;
+  uint64_t start = ndcp::Looper::getTimeNs();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      int i = 0;
+      for (; i < lines || churning.load(std::memory_order_relaxed); i++) {
+        tuya::LogMessage(__FILE__, __LINE__, tuya::LS_INFO).stream()
+            << "thread " << t << " line " << i;
+      }
+      logged.fetch_add(i, std::memory_order_relaxed);
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+  uint64_t elapsed = ndcp::Looper::getTimeNs() - start;
+  if (churner.joinable())
+    churner.join();
+  if (churn)
+    printf("  %d sink swaps\n", swaps);
+  return static_cast<double>(elapsed) / static_cast<double>(logged.load());
+}
+
+int main(int argc, char* argv[]) {
+  const int threads = argc > 1 ? atoi(argv[1]) : 32;
+  const int lines = argc > 2 ? atoi(argv[2]) : 100000;
+  const int swaps = argc > 3 ? atoi(argv[3]) : 200;
+
+  CountingSink sink;
+  CountingSink churn;
+  tuya::LogMessage::LogToDebug(tuya::LS_NONE);
+  tuya::LogMessage::AddLogToStream(&sink, tuya::LS_INFO);
+
+  printf("1 thread:    %.0f ns/line\n", run(1, lines, nullptr, 0));
+  printf("%d threads: %.0f ns/line\n", threads, run(threads, lines, nullptr, 0));
+  double churnNs = run(threads, lines, &churn, swaps);
+  printf("%d threads, sink churn: %.0f ns/line\n", threads, churnNs);
+
+  tuya::LogMessage::RemoveLogToStream(&sink);
+  printf("lines: %llu, churned sink calls: %llu, calls after removal: %llu\n",
+         static_cast<unsigned long long>(sink.calls_.load()),
+         static_cast<unsigned long long>(churn.calls_.load()),
+         static_cast<unsigned long long>(churn.lateCalls_.load()));
+  return churn.lateCalls_.load() == 0 ? 0 : 1;
+}
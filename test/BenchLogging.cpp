@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include "../logger/Logging.h"
+#include "../uvkits/Looper.h"
+
+// Cost of a log line on the calling thread with a slow sink, synchronous
+// versus queued to the writer thread. LogMessage is used directly so the
+// numbers don't depend on NDEBUG.
+class SlowSink : public tuya::LogSink {
+ public:
+  explicit SlowSink(int delayUs) : delay_(delayUs) {}
+  void OnLogMessage(const std::string& message) override {
+    bytes_ += message.size();
+    lines_++;
+    if (delay_.count() > 0)
+      std::this_thread::sleep_for(delay_);
+  }
+  uint64_t lines_ = 0;
+  uint64_t bytes_ = 0;
+
+ private:
+  std::chrono::microseconds delay_;
+};
+
+static double logLines(int count) {
+  uint64_t start = ndcp::Looper::getTimeNs();
+  for (int i = 0; i < count; i++) {
+    tuya::LogMessage(__FILE__, __LINE__, tuya::LS_INFO).stream()
+        << "connection " << i << " closed after " << 3 * i << " bytes, "
+        << 0.5 * i << " ms";
+  }
+  return static_cast<double>(ndcp::Looper::getTimeNs() - start) / count;
+}
+
+int main(int argc, char* argv[]) {
+  const int count = argc > 1 ? atoi(argv[1]) : 100000;
+  // 2us per line is what writing to a busy disk costs.
+  SlowSink sink(argc > 2 ? atoi(argv[2]) : 2);
+  tuya::LogMessage::LogToDebug(tuya::LS_NONE);
+  tuya::LogMessage::AddLogToStream(&sink, tuya::LS_INFO);
+
+  printf("sync:          %.0f ns/line\n", logLines(count / 10));
+
+  tuya::AsyncLoggingOptions options;
+  options.capacity = 1 << 20;
+  tuya::LogMessage::StartAsyncLogging(options);
+  printf("async:         %.0f ns/line\n", logLines(count));
+  tuya::LogMessage::Flush();
+  tuya::LogMessage::StopAsyncLogging();
+
+  // A queue much smaller than the burst, the caller ends up waiting.
+  options.capacity = 1024;
+  options.overflow = tuya::LogOverflowPolicy::kBlock;
+  tuya::LogMessage::StartAsyncLogging(options);
+  double blockNs = logLines(count);
+  tuya::LogMessage::Flush();
+  tuya::AsyncLoggingStats stats = tuya::LogMessage::GetAsyncLoggingStats();
+  printf("async, block:  %.0f ns/line, %llu blocked\n", blockNs,
+         static_cast<unsigned long long>(stats.blocked));
+  tuya::LogMessage::StopAsyncLogging();
+
+  options.overflow = tuya::LogOverflowPolicy::kDrop;
+  tuya::LogMessage::StartAsyncLogging(options);
+  double dropNs = logLines(count);
+  tuya::LogMessage::StopAsyncLogging();
+  stats = tuya::LogMessage::GetAsyncLoggingStats();
+  printf("async, drop:   %.0f ns/line, %llu dropped, %llu written\n", dropNs,
+         static_cast<unsigned long long>(stats.dropped),
+         static_cast<unsigned long long>(stats.written));
+
+  tuya::LogMessage::RemoveLogToStream(&sink);
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "../uvkits/Looper.h"
+
+// Two runs of cross-thread posts to the loop:
+//  - burst: producer threads post timestamped tasks flat out. Reports
+//    throughput and how many wakeups the posts cost; its latencies are
+//    mostly time queued behind the backlog.
+//  - ping-pong: one task in flight at a time, posted once the loop has gone
+//    idle. Reports the post-to-run latency of a single post, wakeup
+//    included.
+
+static void printLatency(const char* what, std::vector<uint64_t>& latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double q) {
+    return latencies.empty() ? 0.0
+        : latencies[static_cast<size_t>(q * (latencies.size() - 1))] / 1000.0;
+  };
+  printf("%s latency us: p50 %.1f p99 %.1f max %.1f\n", what, percentile(0.5),
+         percentile(0.99), percentile(1.0));
+}
+
+static int runBurst(uv_loop_t* loop, size_t producers, size_t perProducer) {
+  const size_t total = producers * perProducer;
+
+  // The task queue doesn't keep the loop alive by itself.
+  uv_timer_t keepAlive;
+  uv_timer_init(loop, &keepAlive);
+  uv_timer_start(&keepAlive, [](uv_timer_t*) {}, 1000, 1000);
+
+  std::vector<uint64_t> latencies;
+  latencies.reserve(total);
+  size_t done = 0;
+
+  std::atomic<bool> go { false };
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p < producers; p++) {
+    threads.emplace_back([&]() {
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+      for (size_t i = 0; i < perProducer; i++) {
+        const uint64_t posted = ndcp::Looper::getTimeNs();
+        ndcp::Looper::postTask([&, posted]() {
+          latencies.push_back(ndcp::Looper::getTimeNs() - posted);
+          if (++done == total)
+            uv_timer_stop(&keepAlive);
+        });
+      }
+    });
+  }
+
+  const ndcp::TaskQueue::Stats before = ndcp::Looper::getTaskStats();
+  const uint64_t start = ndcp::Looper::getTimeNs();
+  go.store(true, std::memory_order_release);
+  ndcp::Looper::loop();
+  const double seconds = (ndcp::Looper::getTimeNs() - start) / 1e9;
+  for (auto& thread : threads)
+    thread.join();
+  const ndcp::TaskQueue::Stats stats = ndcp::Looper::getTaskStats();
+
+  printf("burst: %zu producers, %zu tasks: %.2f M tasks/s\n", producers, done,
+         done / seconds / 1e6);
+  printLatency("burst (queueing)", latencies);
+  const uint64_t posted = stats.posted - before.posted;
+  const uint64_t wakeups = stats.wakeups - before.wakeups;
+  printf("burst: posted %llu, wakeups %llu (%.1f tasks/wakeup)\n",
+         static_cast<unsigned long long>(posted),
+         static_cast<unsigned long long>(wakeups),
+         wakeups ? static_cast<double>(posted) / wakeups : 0.0);
+
+  uv_close(reinterpret_cast<uv_handle_t*>(&keepAlive), nullptr);
+  uv_run(loop, UV_RUN_NOWAIT);
+  return done == total ? 0 : 1;
+}
+
+static int runPingPong(uv_loop_t* loop, size_t rounds, int gapUs) {
+  uv_timer_t keepAlive;
+  uv_timer_init(loop, &keepAlive);
+  uv_timer_start(&keepAlive, [](uv_timer_t*) {}, 1000, 1000);
+
+  std::vector<uint64_t> latencies;
+  latencies.reserve(rounds);
+  std::atomic<size_t> ran { 0 };
+
+  std::thread producer([&]() {
+    for (size_t i = 0; i < rounds; i++) {
+      // Let the loop go back to waiting for events.
+      std::this_thread::sleep_for(std::chrono::microseconds(gapUs));
+      const uint64_t posted = ndcp::Looper::getTimeNs();
+      ndcp::Looper::postTask([&, posted]() {
+        latencies.push_back(ndcp::Looper::getTimeNs() - posted);
+        if (ran.fetch_add(1, std::memory_order_release) + 1 == rounds)
+          uv_timer_stop(&keepAlive);
+      });
+      while (ran.load(std::memory_order_acquire) <= i)
+        std::this_thread::yield();
+    }
+  });
+
+  ndcp::Looper::loop();
+  producer.join();
+
+  printf("ping-pong: %zu tasks, one in flight, %d us apart\n", rounds, gapUs);
+  printLatency("ping-pong (post to run)", latencies);
+
+  uv_close(reinterpret_cast<uv_handle_t*>(&keepAlive), nullptr);
+  uv_run(loop, UV_RUN_NOWAIT);
+  return ran.load() == rounds ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+  const size_t producers = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4;
+  const size_t perProducer = argc > 2 ? strtoul(argv[2], nullptr, 10) : 250000;
+  const size_t rounds = argc > 3 ? strtoul(argv[3], nullptr, 10) : 10000;
+  const int gapUs = argc > 4 ? atoi(argv[4]) : 100;
+
+  ndcp::Looper::init();
+  uv_loop_t* loop = ndcp::Looper::getLooper();
+
+  int err = runBurst(loop, producers, perProducer);
+  err |= runPingPong(loop, rounds, gapUs);
+
+  ndcp::Looper::destory();
+  return err;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+#include "../logger/Logging.h"
+#include "../logger/StringBuilder.h"
+#include "../uvkits/Looper.h"
+
+// Cost of building a typical log line with StringBuilder versus
+// std::ostringstream, and of a whole LogMessage going to a sink.
+class NullSink : public tuya::LogSink {
+ public:
+  void OnLogMessage(const std::string& message) override {
+    bytes_ += message.size();
+  }
+  uint64_t bytes_ = 0;
+};
+
+static const char* const kPaths[] = {"/", "/users/42", "/static/app.js"};
+
+template <typename Stream>
+static size_t build(Stream& stream, int i) {
+  stream << "(HttpConnection.cpp:" << 523 << "): GET " << kPaths[i % 3]
+         << " 200 " << 512 + i % 4096 << " bytes in " << 0.25 * (i % 100)
+         << " ms, conn " << static_cast<unsigned long long>(i / 8) << " "
+         << static_cast<const void*>(kPaths) << "\n";
+  return stream.str().size();
+}
+
+int main(int argc, char* argv[]) {
+  const int count = argc > 1 ? atoi(argv[1]) : 1000000;
+  size_t bytes = 0;
+
+  uint64_t start = ndcp::Looper::getTimeNs();
+  for (int i = 0; i < count; i++) {
+    tuya::StringBuilder stream;
+    bytes += build(stream, i);
+  }
+  double builderNs = static_cast<double>(ndcp::Looper::getTimeNs() - start) / count;
+
+  start = ndcp::Looper::getTimeNs();
+  for (int i = 0; i < count; i++) {
+    std::ostringstream stream;
+    bytes += build(stream, i);
+  }
+  double streamNs = static_cast<double>(ndcp::Looper::getTimeNs() - start) / count;
+
+  NullSink sink;
+  tuya::LogMessage::LogToDebug(tuya::LS_NONE);
+  tuya::LogMessage::AddLogToStream(&sink, tuya::LS_INFO);
+  start = ndcp::Looper::getTimeNs();
+  for (int i = 0; i < count; i++) {
+    LOGI << "GET " << kPaths[i % 3] << " 200 " << 512 + i % 4096
+         << " bytes in " << 0.25 * (i % 100) << " ms, conn " << i / 8;
+  }
+  double logNs = static_cast<double>(ndcp::Looper::getTimeNs() - start) / count;
+  tuya::LogMessage::RemoveLogToStream(&sink);
+
+  // Both have to render the same text.
+  tuya::StringBuilder builder;
+  std::ostringstream stream;
+  build(builder, 12345);
+  build(stream, 12345);
+  const bool same = builder.str() == stream.str();
+
+  printf("StringBuilder:      %.0f ns/line\n", builderNs);
+  printf("std::ostringstream: %.0f ns/line\n", streamNs);
+  printf("LOGI to a sink:     %.0f ns/line\n", logNs);
+  printf("%llu + %llu bytes, output %s\n",
+         static_cast<unsigned long long>(bytes),
+         static_cast<unsigned long long>(sink.bytes_),
+         same ? "identical" : "DIFFERS");
+  return same ? 0 : 1;
+}
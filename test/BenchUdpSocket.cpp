@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../uvkits/Looper.h"
+#include "../uvkits/UdpSocket.h"
+
+// Loopback packets/sec and syscalls/packet of UdpSocket, once with a batch
+// of 1 (one recvmsg/sendmsg per datagram, what uv_udp_t does without
+// UV_UDP_RECVMMSG) and once batched. Sender and receiver share one loop, the
+// sender keeps a bounded window in flight so the socket buffer never drops.
+struct Run {
+  ndcp::UdpSocket* sender;
+  ndcp::UdpSocket* receiver;
+  struct sockaddr_storage target;
+  uint64_t total;
+  uint64_t window;
+  uint64_t queued { 0 };
+  uint64_t received { 0 };
+  uint64_t lastReceived { 0 };
+  char payload[1200];
+  uv_idle_t pump;
+  uv_timer_t watchdog;
+};
+
+static void stopRun(Run* run) {
+  uv_idle_stop(&run->pump);
+  uv_timer_stop(&run->watchdog);
+  run->receiver->stopRecv();
+}
+
+static void onPump(uv_idle_t* handle) {
+  Run* run = static_cast<Run*>(handle->data);
+  while (run->queued < run->total && run->queued - run->received < run->window) {
+    if (run->sender->send(reinterpret_cast<struct sockaddr*>(&run->target),
+                          run->payload, sizeof(run->payload)) != 0)
+      break;
+    run->queued++;
+  }
+  run->sender->flush();
+}
+
+static void onWatchdog(uv_timer_t* handle) {
+  Run* run = static_cast<Run*>(handle->data);
+  // No progress for a whole period: the rest was dropped.
+  if (run->received == run->lastReceived)
+    stopRun(run);
+  run->lastReceived = run->received;
+}
+
+static void bench(uv_loop_t* loop, size_t batchSize, uint64_t total) {
+  ndcp::UdpSocket::Options options;
+  options.batchSize = batchSize;
+  options.socketBufferSize = 4 * 1024 * 1024;
+  ndcp::UdpSocket sender(loop, options);
+  ndcp::UdpSocket receiver(loop, options);
+  if (sender.bind("127.0.0.1", 0) != 0 || receiver.bind("127.0.0.1", 0) != 0)
+    exit(1);
+
+  Run run;
+  run.sender = &sender;
+  run.receiver = &receiver;
+  run.total = total;
+  run.window = 512;
+  memset(run.payload, 'x', sizeof(run.payload));
+  receiver.getSockName(&run.target);
+
+  receiver.startRecv([&run](const ndcp::UdpPacket*, size_t count) {
+    run.received += count;
+    if (run.received >= run.total)
+      stopRun(&run);
+  });
+  uv_idle_init(loop, &run.pump);
+  run.pump.data = &run;
+  uv_idle_start(&run.pump, onPump);
+  uv_timer_init(loop, &run.watchdog);
+  run.watchdog.data = &run;
+  uv_timer_start(&run.watchdog, onWatchdog, 1000, 1000);
+
+  uint64_t start = ndcp::Looper::getTimeNs();
+  uv_run(loop, UV_RUN_DEFAULT);
+  double seconds = (ndcp::Looper::getTimeNs() - start) / 1e9;
+
+  ndcp::UdpSocket::Stats tx = sender.getStats();
+  ndcp::UdpSocket::Stats rx = receiver.getStats();
+  printf("batch %3zu: %llu/%llu packets, %.0f pps, recv %.3f syscalls/packet, "
+         "send %.3f syscalls/packet\n",
+         batchSize, static_cast<unsigned long long>(rx.packetsReceived),
+         static_cast<unsigned long long>(total), rx.packetsReceived / seconds,
+         static_cast<double>(rx.recvCalls) / (rx.packetsReceived ? rx.packetsReceived : 1),
+         static_cast<double>(tx.sendCalls) / (tx.packetsSent ? tx.packetsSent : 1));
+
+  uv_close(reinterpret_cast<uv_handle_t*>(&run.pump), nullptr);
+  uv_close(reinterpret_cast<uv_handle_t*>(&run.watchdog), nullptr);
+  sender.close(nullptr);
+  receiver.close(nullptr);
+  uv_run(loop, UV_RUN_DEFAULT);
+}
+
+int main(int argc, char* argv[]) {
+  const uint64_t total = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  uv_loop_t* loop = ndcp::Looper::getLooper();
+
+  bench(loop, 1, total);
+  bench(loop, 64, total);
+
+  ndcp::Looper::destory();
+  return 0;
+}
@@ -1,6 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "../uvkits/Looper.h"
 #include "../service/HttpServer.h"
+#include "../service/HttpConnection.h"
+#include "../logger/FlightRecorderSink.h"
 #if defined(WIN)
 #pragma comment(lib, "psapi")
 #pragma comment(lib, "user32")
@@ -9,8 +12,30 @@
 #pragma comment(lib, "userenv")
 #pragma comment(lib, "ws2_32")
 #endif
-int main() {
-  ndcp::HttpServer* server = new ndcp::HttpServer;
+int main(int argc, char* argv[]) {
+  // Optional first argument: number of loops serving the port (0 = per CPU).
+  int threads = argc > 1 ? atoi(argv[1]) : 1;
+  ndcp::HttpServer* server = new ndcp::HttpServer(threads);
+  server->router().add(HTTP_GET, "/", [](ndcp::HttpConnection* connection,
+      const ndcp::HttpRequest& request) {
+    connection->WriteResponse(request.seq, 200, "Hello, World!\n");
+  });
+  server->router().add(HTTP_GET, "/users/:id", [](ndcp::HttpConnection* connection,
+      const ndcp::HttpRequest& request) {
+    std::string body = "user ";
+    body.append(request.params.get("id"));
+    body += "\n";
+    connection->WriteResponse(request.seq, 200, body);
+  });
+  // Verbose lines are kept in memory only, see /debug/logs?severity=info.
+  static tuya::FlightRecorderSink recorder;
+  tuya::LogMessage::AddLogToStream(&recorder, tuya::LS_VERBOSE);
+  server->addLogEndpoint(&recorder);
+  // Warn when a loop falls behind, see getLoopStats() for the histograms.
+  ndcp::Looper::getMain()->startMonitor();
+  ndcp::Looper::getMain()->startWatchdog();
+  server->setLoopMonitor(ndcp::LoopMonitor::Options());
+  server->setLoopWatchdog(ndcp::LoopWatchdog::Options());
   server->start("0.0.0.0", 8090);
   ndcp::Looper::loop();
   return 0;
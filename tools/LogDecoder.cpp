@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <string>
+#include "../logger/BinaryLog.h"
+
+// Renders a binary log written with tuya::BinaryLog as text.
+//   logDecoder <binary log> [text output]
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <binary log> [text output]\n", argv[0]);
+    return 2;
+  }
+
+  FILE* in = fopen(argv[1], "rb");
+  if (in == nullptr) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::string data;
+  char buf[64 * 1024];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    data.append(buf, n);
+  fclose(in);
+
+  std::string text;
+  bool ok = tuya::BinaryLog::Decode(data.data(), data.size(), &text);
+
+  FILE* out = argc > 2 ? fopen(argv[2], "wb") : stdout;
+  if (out == nullptr) {
+    perror(argv[2]);
+    return 1;
+  }
+  fwrite(text.data(), 1, text.size(), out);
+  if (out != stdout)
+    fclose(out);
+
+  fprintf(stderr, "%zu binary bytes, %zu text bytes (%.1fx)%s\n", data.size(),
+          text.size(), data.empty() ? 0.0 : double(text.size()) / data.size(),
+          ok ? "" : ", truncated or malformed input");
+  return ok ? 0 : 1;
+}
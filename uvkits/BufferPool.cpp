@@ -0,0 +1,175 @@
+#include "BufferPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__LINUX__) || defined(__ANDROID__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+namespace ndcp {
+
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// The counters have a single writer, the owning loop, so plain loads and
+// stores do; they are atomic for getStats() only.
+template <typename T>
+static inline T load(const std::atomic<T> &counter) {
+	return counter.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+static inline void set(std::atomic<T> &counter, T value) {
+	counter.store(value, std::memory_order_relaxed);
+}
+
+static size_t roundUpPow2(size_t size) {
+	size_t n = 1;
+	while (n < size)
+		n <<= 1;
+	return n;
+}
+
+BufferPool::BufferPool() : BufferPool(Options()) {
+
+}
+
+BufferPool::BufferPool(const Options &options) : options_(options) {
+	options_.minSize = roundUpPow2(options_.minSize < sizeof(FreeSlab) ?
+			sizeof(FreeSlab) : options_.minSize);
+	options_.maxSize = roundUpPow2(options_.maxSize < options_.minSize ?
+			options_.minSize : options_.maxSize);
+
+	size_t count = 0;
+	for (size_t size = options_.minSize; size <= options_.maxSize; size <<= 1)
+		count++;
+	// Sized once, the atomics can't move.
+	classes_ = std::vector<SizeClass>(count);
+	for (size_t i = 0; i < count; i++)
+		classes_[i].slabSize = options_.minSize << i;
+}
+
+BufferPool::~BufferPool() {
+	for (auto &chunk : chunks_) {
+#if defined(__LINUX__) || defined(__ANDROID__) || defined(__APPLE__)
+		if (chunk.mapped) {
+			munmap(chunk.base, chunk.size);
+			continue;
+		}
+#endif
+		free(chunk.base);
+	}
+}
+
+int BufferPool::classIndex(size_t size) const {
+	int index = 0;
+	for (size_t slab = options_.minSize; slab < size; slab <<= 1)
+		index++;
+	return index;
+}
+
+char* BufferPool::acquire(size_t size, size_t *len) {
+	if (size > options_.maxSize) {
+		set(oversize_, load(oversize_) + 1);
+		size = options_.maxSize;
+	}
+
+	SizeClass &sizeClass = classes_[classIndex(size)];
+	if (sizeClass.freeList == nullptr) {
+		set(sizeClass.misses, load(sizeClass.misses) + 1);
+		if (!refill(sizeClass)) {
+			*len = 0;
+			return nullptr;
+		}
+	} else {
+		set(sizeClass.hits, load(sizeClass.hits) + 1);
+	}
+
+	FreeSlab *slab = sizeClass.freeList;
+	sizeClass.freeList = slab->next;
+
+	const size_t inUse = load(sizeClass.inUse) + 1;
+	set(sizeClass.inUse, inUse);
+	if (inUse > load(sizeClass.highWater))
+		set(sizeClass.highWater, inUse);
+	const size_t inUseBytes = load(inUseBytes_) + sizeClass.slabSize;
+	set(inUseBytes_, inUseBytes);
+	if (inUseBytes > load(highWaterBytes_))
+		set(highWaterBytes_, inUseBytes);
+
+	*len = sizeClass.slabSize;
+	return reinterpret_cast<char*>(slab);
+}
+
+void BufferPool::release(char *buf, size_t len) {
+	if (buf == nullptr || len == 0)
+		return;
+
+	SizeClass &sizeClass = classes_[classIndex(len)];
+	auto *slab = reinterpret_cast<FreeSlab*>(buf);
+	slab->next = sizeClass.freeList;
+	sizeClass.freeList = slab;
+	set(sizeClass.inUse, load(sizeClass.inUse) - 1);
+	set(inUseBytes_, load(inUseBytes_) - sizeClass.slabSize);
+}
+
+bool BufferPool::refill(SizeClass &sizeClass) {
+	size_t chunkSize = options_.chunkSize < sizeClass.slabSize ?
+			sizeClass.slabSize : options_.chunkSize;
+	Chunk chunk = allocateChunk(chunkSize);
+	if (chunk.base == nullptr)
+		return false;
+	chunks_.push_back(chunk);
+	set(reservedBytes_, load(reservedBytes_) + chunk.size);
+
+	// Thread the new slabs onto the free list, lowest address first.
+	size_t count = chunk.size / sizeClass.slabSize;
+	for (size_t i = count; i > 0; i--) {
+		auto *slab = reinterpret_cast<FreeSlab*>(chunk.base + (i - 1) * sizeClass.slabSize);
+		slab->next = sizeClass.freeList;
+		sizeClass.freeList = slab;
+	}
+	set(sizeClass.reserved, load(sizeClass.reserved) + count);
+	return true;
+}
+
+BufferPool::Chunk BufferPool::allocateChunk(size_t size) {
+	Chunk chunk = { nullptr, size, false };
+#if defined(__LINUX__) || defined(__ANDROID__)
+	if (options_.hugePages) {
+		size = (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+		void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base == MAP_FAILED) {
+			// No reserved hugepages, ask for transparent ones instead.
+			base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (base != MAP_FAILED)
+				madvise(base, size, MADV_HUGEPAGE);
+		}
+		if (base != MAP_FAILED) {
+			chunk.base = static_cast<char*>(base);
+			chunk.size = size;
+			chunk.mapped = true;
+			return chunk;
+		}
+		printf("hugepage chunk allocation failed, using the heap\n");
+	}
+#endif
+	chunk.base = static_cast<char*>(malloc(size));
+	return chunk;
+}
+
+BufferPool::Stats BufferPool::getStats() const {
+	Stats stats = { 0, 0, load(oversize_), load(inUseBytes_), load(highWaterBytes_),
+			load(reservedBytes_), {} };
+	for (auto &sizeClass : classes_) {
+		ClassStats classStats = { sizeClass.slabSize, load(sizeClass.hits),
+				load(sizeClass.misses), load(sizeClass.inUse), load(sizeClass.highWater),
+				load(sizeClass.reserved) };
+		stats.hits += classStats.hits;
+		stats.misses += classStats.misses;
+		stats.classes.push_back(classStats);
+	}
+	return stats;
+}
+
+} //namespace ndcp
@@ -0,0 +1,99 @@
+#ifndef __NDCP_BUFFER_POOL_H__
+#define __NDCP_BUFFER_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace ndcp {
+
+/*
+ * Size-classed pool of fixed-size slabs with free-list reuse.
+ *
+ * Classes are powers of two between minSize and maxSize. Slabs are carved
+ * from larger chunks (optionally hugepage backed) which are only returned to
+ * the system when the pool is destroyed. The pool is not thread safe: each
+ * loop owns its own. Only getStats() may be called from other threads.
+ */
+class BufferPool {
+public:
+	struct Options {
+		size_t minSize { 2048 };
+		size_t maxSize { 65536 };
+		size_t chunkSize { 1024 * 1024 };
+		bool hugePages { false };
+	};
+
+	struct ClassStats {
+		size_t slabSize;
+		uint64_t hits;      // served from the free list
+		uint64_t misses;    // free list empty, a chunk had to be carved
+		size_t inUse;
+		size_t highWater;   // max slabs in use at the same time
+		size_t reserved;    // slabs carved so far
+	};
+
+	struct Stats {
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t oversize;  // requests above maxSize, clamped to it
+		size_t inUseBytes;
+		size_t highWaterBytes;
+		size_t reservedBytes;
+		std::vector<ClassStats> classes;
+	};
+
+	BufferPool();
+	explicit BufferPool(const Options &options);
+	~BufferPool();
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	// Returns a buffer of at least min(|size|, maxSize) bytes and stores its
+	// usable length in |len|. Returns nullptr with |len| 0 when out of memory.
+	char* acquire(size_t size, size_t *len);
+	// |len| must be the length handed out by acquire().
+	void release(char *buf, size_t len);
+
+	Stats getStats() const;
+
+private:
+	struct FreeSlab {
+		FreeSlab *next;
+	};
+
+	struct SizeClass {
+		size_t slabSize { 0 };
+		FreeSlab *freeList { nullptr };
+		// Written by the owning loop only, read by getStats().
+		std::atomic<uint64_t> hits { 0 };
+		std::atomic<uint64_t> misses { 0 };
+		std::atomic<size_t> inUse { 0 };
+		std::atomic<size_t> highWater { 0 };
+		std::atomic<size_t> reserved { 0 };
+	};
+
+	struct Chunk {
+		char *base;
+		size_t size;
+		bool mapped;
+	};
+
+	int classIndex(size_t size) const;
+	bool refill(SizeClass &sizeClass);
+	Chunk allocateChunk(size_t size);
+
+private:
+	Options options_;
+	std::vector<SizeClass> classes_;
+	std::vector<Chunk> chunks_;
+	std::atomic<uint64_t> oversize_ { 0 };
+	std::atomic<size_t> inUseBytes_ { 0 };
+	std::atomic<size_t> highWaterBytes_ { 0 };
+	std::atomic<size_t> reservedBytes_ { 0 };
+};
+
+} //namespace ndcp
+#endif //__NDCP_BUFFER_POOL_H__
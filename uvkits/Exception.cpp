@@ -1,13 +1,28 @@
 #include "Exception.h"
+#include "StackTrace.h"
 
 namespace ndcp {
 
-Exception::Exception(const std::string &message) : message_(message) {}
+Exception::Exception(const std::string &message) : message_(message) {
+    // Only the addresses here, throwing stays cheap.
+    frameCount_ = captureStack(frames_, kMaxFrames, 1);
+}
 
 const char *Exception::what() const throw()
 {
     return message_.c_str();
 }
 
+const char *Exception::stackTrace() const noexcept
+{
+    if (stack_.empty() && frameCount_ > 0) {
+        try {
+            stack_ = symbolizeStack(frames_, frameCount_);
+        } catch (...) {
+        }
+    }
+    return stack_.c_str();
+}
+
 
 } // namespace ndcp
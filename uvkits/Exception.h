@@ -14,13 +14,15 @@ public:
 
     const char* what() const throw() override;
 
-    const char* stackTrace() const noexcept
-    {
-      return stack_.c_str();
-    }
+    // Where the exception was constructed, symbolized on first use.
+    const char* stackTrace() const noexcept;
 private:
+    static constexpr int kMaxFrames = 32;
+
     std::string message_;
-    std::string stack_;
+    mutable std::string stack_;
+    void *frames_[kMaxFrames];
+    int frameCount_;
 
 };
 
@@ -0,0 +1,253 @@
+#include "Executor.h"
+#include <algorithm>
+#include "Looper.h"
+#include "../logger/ThreadTypes.h"
+
+namespace ndcp {
+
+// Stealing takes at most that many tasks at once.
+static constexpr size_t kMaxSteal = 32;
+// Rounds of yielding before a worker out of work parks, given a CPU to
+// spare. On a single one the spinning worker only delays the thread that
+// would hand it more work, or run the completions.
+static constexpr int kSpinRounds = 16;
+
+// The Executor and Worker the calling thread belongs to, if any.
+static thread_local const Executor *currentExecutor_ { nullptr };
+static thread_local void *currentWorker_ { nullptr };
+// Round robin over the workers, per submitting thread.
+static thread_local uint32_t nextWorker_ { 0 };
+
+static inline void bump(std::atomic<uint64_t> &counter, uint64_t by) {
+	counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+Executor::Executor() : Executor(Options()) {
+}
+
+Executor::Executor(const Options &options) : options_(options) {
+	unsigned cpus = std::thread::hardware_concurrency();
+	if (options_.threads <= 0)
+		options_.threads = cpus > 0 ? static_cast<int>(cpus) : 1;
+	spinRounds_ = cpus > 1 ? kSpinRounds : 0;
+}
+
+Executor::~Executor() {
+	stop();
+}
+
+int Executor::start() {
+	if (running_ || !workers_.empty())
+		return UV_EBUSY;
+
+	stopping_ = false;
+	for (int i = 0; i < options_.threads; i++) {
+		workers_.emplace_back(new Worker);
+		workers_.back()->random = static_cast<uint32_t>(i) * 2654435761u + 1;
+	}
+	running_ = true;
+	for (int i = 0; i < options_.threads; i++)
+		workers_[i]->thread = std::thread(&Executor::run, this, i);
+	return 0;
+}
+
+void Executor::stop() {
+	if (workers_.empty())
+		return;
+	running_.store(false, std::memory_order_seq_cst);
+	// A push that got past the check still queues its job, and uses
+	// workers_. The workers only leave once that job ran.
+	while (producers_.load(std::memory_order_seq_cst) > 0)
+		std::this_thread::yield();
+	{
+		std::lock_guard<std::mutex> _(parkMutex_);
+		stopping_ = true;
+	}
+	parked_.notify_all();
+	for (auto &worker : workers_)
+		worker->thread.join();
+	workers_.clear();
+}
+
+bool Executor::execute(std::function<void()> work) {
+	return push(new Job(std::move(work), nullptr, nullptr, false));
+}
+
+bool Executor::submit(std::function<void()> work, std::function<void()> done,
+		Looper *looper) {
+	if (looper == nullptr)
+		looper = Looper::current();
+	if (looper == nullptr)
+		return false;
+
+	// Hold the loop from its own thread only, that's where it is released.
+	bool held = looper->isCurrent();
+	if (held)
+		looper->hold();
+	if (!push(new Job(std::move(work), std::move(done), looper, held))) {
+		if (held)
+			looper->release();
+		return false;
+	}
+	return true;
+}
+
+int Executor::getThreadCount() const {
+	return options_.threads;
+}
+
+Executor::Stats Executor::getStats() const {
+	Stats stats {};
+	for (auto &worker : workers_) {
+		{
+			std::lock_guard<std::mutex> _(worker->mutex);
+			stats.submitted += worker->submitted;
+		}
+		stats.executed += worker->executed.load(std::memory_order_relaxed);
+		stats.stolen += worker->stolen.load(std::memory_order_relaxed);
+		stats.parks += worker->parks.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+bool Executor::push(Job *job) {
+	producers_.fetch_add(1, std::memory_order_seq_cst);
+	if (!running_.load(std::memory_order_seq_cst)) {
+		producers_.fetch_sub(1, std::memory_order_release);
+		delete job;
+		return false;
+	}
+
+	Worker *worker;
+	if (currentExecutor_ == this) {
+		worker = static_cast<Worker*>(currentWorker_);
+	} else {
+		worker = workers_[nextWorker_++ % workers_.size()].get();
+	}
+	{
+		std::lock_guard<std::mutex> _(worker->mutex);
+		worker->jobs.push_back(job);
+		worker->submitted++;
+	}
+
+	// Pairs with the check in run(): either the worker going to sleep sees
+	// the job, or this sees it sleeping.
+	pending_.fetch_add(1, std::memory_order_seq_cst);
+	if (sleeping_.load(std::memory_order_seq_cst) > 0) {
+		std::lock_guard<std::mutex> _(parkMutex_);
+		parked_.notify_one();
+	}
+	producers_.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+bool Executor::take(Worker *worker, Job **job) {
+	std::lock_guard<std::mutex> _(worker->mutex);
+	if (worker->jobs.empty())
+		return false;
+	*job = worker->jobs.front();
+	worker->jobs.pop_front();
+	pending_.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool Executor::steal(Worker *thief, Job **job) {
+	const size_t count = workers_.size();
+	if (count < 2)
+		return false;
+
+	// xorshift, for where to start looking.
+	uint32_t random = thief->random;
+	random ^= random << 13;
+	random ^= random >> 17;
+	random ^= random << 5;
+	thief->random = random;
+
+	Job *loot[kMaxSteal];
+	for (size_t i = 0; i < count; i++) {
+		Worker *victim = workers_[(random + i) % count].get();
+		if (victim == thief)
+			continue;
+
+		size_t taken;
+		{
+			std::lock_guard<std::mutex> _(victim->mutex);
+			size_t size = victim->jobs.size();
+			if (size == 0)
+				continue;
+			// The newer half, the victim works on the older one.
+			taken = std::min((size + 1) / 2, kMaxSteal);
+			auto first = victim->jobs.end() - taken;
+			std::copy(first, victim->jobs.end(), loot);
+			victim->jobs.erase(first, victim->jobs.end());
+		}
+
+		*job = loot[0];
+		if (taken > 1) {
+			std::lock_guard<std::mutex> _(thief->mutex);
+			thief->jobs.insert(thief->jobs.end(), loot + 1, loot + taken);
+		}
+		pending_.fetch_sub(1, std::memory_order_relaxed);
+		bump(thief->stolen, taken);
+		return true;
+	}
+	return false;
+}
+
+void Executor::finish(Job *job) {
+	job->work();
+	if (job->looper == nullptr) {
+		delete job;
+		return;
+	}
+	// The Job itself is the completion, the Looper deletes it once run. A
+	// Looper already gone has nothing left to release either.
+	job->work = nullptr;
+	job->looper->post(job);
+}
+
+// On the Looper.
+void Executor::Job::run() {
+	if (done)
+		done();
+	if (held)
+		looper->release();
+}
+
+void Executor::run(int index) {
+	Worker *self = workers_[index].get();
+	currentExecutor_ = this;
+	currentWorker_ = self;
+	tuya::SetCurrentThreadName((options_.name + "-" + std::to_string(index)).c_str());
+
+	Job *job = nullptr;
+	for (;;) {
+		bool found = take(self, &job) || steal(self, &job);
+		for (int round = 0; !found && round < spinRounds_; round++) {
+			std::this_thread::yield();
+			if (pending_.load(std::memory_order_relaxed) > 0)
+				found = take(self, &job) || steal(self, &job);
+		}
+		if (found) {
+			finish(job);
+			bump(self->executed, 1);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(parkMutex_);
+		sleeping_.fetch_add(1, std::memory_order_seq_cst);
+		while (pending_.load(std::memory_order_seq_cst) <= 0 && !stopping_) {
+			bump(self->parks, 1);
+			parked_.wait(lock);
+		}
+		sleeping_.fetch_sub(1, std::memory_order_relaxed);
+		// Stopping, once everything queued ran.
+		if (stopping_ && pending_.load(std::memory_order_seq_cst) <= 0)
+			break;
+	}
+
+	currentExecutor_ = nullptr;
+	currentWorker_ = nullptr;
+}
+
+} // namespace ndcp
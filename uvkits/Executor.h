@@ -0,0 +1,128 @@
+#ifndef __NDCP_EXECUTOR_H__
+#define __NDCP_EXECUTOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TaskQueue.h"
+
+namespace ndcp {
+
+class Looper;
+
+/*
+ * Thread pool for CPU-bound work, kept apart from the libuv threadpool,
+ * which filesystem and DNS requests queue on.
+ *
+ * Every worker has a deque of its own. Work submitted from outside goes
+ * round robin onto them, work submitted from a worker onto its own. A
+ * worker runs its deque oldest first; once empty it steals half of the
+ * newest tasks of another, and only parks when there is nothing left to
+ * steal.
+ *
+ * submit() hands the result back to a Looper: |done| is posted to it once
+ * |work| ran, and the loop is held open meanwhile.
+ */
+class Executor {
+public:
+	struct Options {
+		// 0 means one per CPU.
+		int threads { 0 };
+		// Threads are named <name>-<index>.
+		std::string name { "cpu" };
+	};
+
+	struct Stats {
+		uint64_t submitted;
+		uint64_t executed;
+		// Tasks moved from one deque to another by stealing.
+		uint64_t stolen;
+		uint64_t parks;
+	};
+
+	Executor();
+	explicit Executor(const Options &options);
+	// Stops if still running.
+	~Executor();
+
+	Executor(const Executor&) = delete;
+	Executor& operator=(const Executor&) = delete;
+
+	int start();
+	// Runs what is queued, then joins the workers. Submissions racing it
+	// either get queued and run, or fail.
+	void stop();
+
+	// Runs |work| on a worker. Returns false, dropping it, unless running.
+	bool execute(std::function<void()> work);
+	// Runs |work| on a worker, then |done| on |looper|, or on the Looper of
+	// the calling thread if nullptr. The loop is held open until |done| ran
+	// when submitting from its own thread. |done| may be empty, to only wait
+	// on the loop for |work|. Returns false if not running or without a
+	// Looper.
+	bool submit(std::function<void()> work, std::function<void()> done,
+			Looper *looper = nullptr);
+
+	int getThreadCount() const;
+	Stats getStats() const;
+
+private:
+	/* A submitted task; posted on to its Looper as the completion. */
+	struct Job : TaskQueue::Node {
+		Job(std::function<void()> work, std::function<void()> done, Looper *looper,
+				bool held) : work(std::move(work)), done(std::move(done)),
+				looper(looper), held(held) {}
+		void run() override;
+
+		std::function<void()> work;
+		std::function<void()> done;
+		Looper *looper;
+		bool held;
+	};
+
+	struct alignas(64) Worker {
+		std::mutex mutex;
+		std::deque<Job*> jobs;
+		// Guarded by |mutex|.
+		uint64_t submitted { 0 };
+		std::thread thread;
+		uint32_t random { 0 };
+		// Written by the worker only.
+		std::atomic<uint64_t> executed { 0 };
+		std::atomic<uint64_t> stolen { 0 };
+		std::atomic<uint64_t> parks { 0 };
+	};
+
+	bool push(Job *job);
+	bool take(Worker *worker, Job **job);
+	bool steal(Worker *thief, Job **job);
+	void finish(Job *job);
+	void run(int index);
+
+private:
+	Options options_;
+	int spinRounds_ { 0 };
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<bool> running_ { false };
+	// Pushes in progress, stop() waits for them.
+	std::atomic<int> producers_ { 0 };
+
+	// Queued, not yet taken, across every deque.
+	alignas(64) std::atomic<int64_t> pending_ { 0 };
+	std::atomic<int> sleeping_ { 0 };
+	std::mutex parkMutex_;
+	std::condition_variable parked_;
+	bool stopping_ { false };
+};
+
+} // namespace ndcp
+
+#endif //__NDCP_EXECUTOR_H__
@@ -0,0 +1,70 @@
+#include "Histogram.h"
+
+namespace ndcp {
+
+static inline int bucketOf(uint64_t value) {
+	if (value == 0)
+		return 0;
+#if defined(_MSC_VER)
+	int bucket = 0;
+	for (uint64_t rest = value; rest != 0; rest >>= 1)
+		bucket++;
+#else
+	int bucket = 64 - __builtin_clzll(value);
+#endif
+	return bucket < Histogram::kBuckets ? bucket : Histogram::kBuckets - 1;
+}
+
+void Histogram::record(uint64_t value) {
+	// Single writer: plain load and store, no read-modify-write needed.
+	auto bump = [](std::atomic<uint64_t> &counter, uint64_t by) {
+		counter.store(counter.load(std::memory_order_relaxed) + by,
+				std::memory_order_relaxed);
+	};
+	bump(buckets_[bucketOf(value)], 1);
+	bump(count_, 1);
+	bump(sum_, value);
+	if (value > max_.load(std::memory_order_relaxed))
+		max_.store(value, std::memory_order_relaxed);
+}
+
+void Histogram::reset() {
+	for (auto &bucket : buckets_)
+		bucket.store(0, std::memory_order_relaxed);
+	count_.store(0, std::memory_order_relaxed);
+	sum_.store(0, std::memory_order_relaxed);
+	max_.store(0, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+	Snapshot snapshot {};
+	uint64_t count = 0;
+	for (int i = 0; i < kBuckets; i++) {
+		snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+		count += snapshot.buckets[i];
+	}
+	snapshot.count = count;
+	snapshot.sum = sum_.load(std::memory_order_relaxed);
+	snapshot.max = max_.load(std::memory_order_relaxed);
+
+	auto percentile = [&](uint64_t permille) -> uint64_t {
+		if (count == 0)
+			return 0;
+		uint64_t rank = (count * permille + 999) / 1000;
+		uint64_t seen = 0;
+		for (int i = 0; i < kBuckets; i++) {
+			seen += snapshot.buckets[i];
+			if (seen >= rank) {
+				uint64_t upper = i == 0 ? 0 : (uint64_t(1) << i) - 1;
+				return upper < snapshot.max ? upper : snapshot.max;
+			}
+		}
+		return snapshot.max;
+	};
+	snapshot.p50 = percentile(500);
+	snapshot.p90 = percentile(900);
+	snapshot.p99 = percentile(990);
+	return snapshot;
+}
+
+} // namespace ndcp
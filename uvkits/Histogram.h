@@ -0,0 +1,47 @@
+#ifndef __NDCP_HISTOGRAM_H__
+#define __NDCP_HISTOGRAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace ndcp {
+
+/*
+ * Histogram of durations in power of two buckets: bucket 0 counts zeros,
+ * bucket i counts values in [2^(i-1), 2^i). One thread records, any thread
+ * may take a snapshot, which is then only roughly consistent.
+ */
+class Histogram {
+public:
+	static constexpr int kBuckets = 32;
+
+	struct Snapshot {
+		uint64_t count;
+		uint64_t sum;
+		uint64_t max;
+		// Upper bounds of the buckets the percentiles fall in.
+		uint64_t p50;
+		uint64_t p90;
+		uint64_t p99;
+		uint64_t buckets[kBuckets];
+	};
+
+	Histogram() = default;
+	Histogram(const Histogram&) = delete;
+	Histogram& operator=(const Histogram&) = delete;
+
+	void record(uint64_t value);
+	void reset();
+	Snapshot snapshot() const;
+
+private:
+	std::atomic<uint64_t> buckets_[kBuckets] {};
+	std::atomic<uint64_t> count_ { 0 };
+	std::atomic<uint64_t> sum_ { 0 };
+	std::atomic<uint64_t> max_ { 0 };
+};
+
+} // namespace ndcp
+
+#endif //__NDCP_HISTOGRAM_H__
@@ -0,0 +1,145 @@
+#include "LoopMonitor.h"
+#include "../logger/Logging.h"
+
+// uv_metrics_idle_time() came with libuv 1.39.
+#if UV_VERSION_HEX >= 0x012700
+#define NDCP_UV_IDLE_TIME 1
+#endif
+
+namespace ndcp {
+
+int LoopMonitor::start(uv_loop_t *loop, const Options &options, const std::string &name) {
+	if (running_ || closing_ != 0)
+		return UV_EBUSY;
+
+	loop_ = loop;
+	options_ = options;
+	name_ = name;
+	prepareNs_ = 0;
+	idleNs_ = 0;
+#if defined(NDCP_UV_IDLE_TIME)
+	uv_loop_configure(loop, UV_METRICS_IDLE_TIME);
+#endif
+
+	// None of these fail in libuv, they only ever return 0.
+	uv_prepare_init(loop, &prepare_);
+	prepare_.data = this;
+	uv_prepare_start(&prepare_, static_cast<uv_prepare_cb>(onPrepare));
+	uv_unref(reinterpret_cast<uv_handle_t*>(&prepare_));
+
+	uv_check_init(loop, &check_);
+	check_.data = this;
+	uv_check_start(&check_, static_cast<uv_check_cb>(onCheck));
+	uv_unref(reinterpret_cast<uv_handle_t*>(&check_));
+
+	uv_timer_init(loop, &lagTimer_);
+	lagTimer_.data = this;
+	uv_unref(reinterpret_cast<uv_handle_t*>(&lagTimer_));
+	running_ = true;
+	armLagTimer();
+	return 0;
+}
+
+void LoopMonitor::stop() {
+	if (!running_)
+		return;
+	running_ = false;
+	closing_ = 3;
+	uv_close(reinterpret_cast<uv_handle_t*>(&prepare_), static_cast<uv_close_cb>(onClose));
+	uv_close(reinterpret_cast<uv_handle_t*>(&check_), static_cast<uv_close_cb>(onClose));
+	uv_close(reinterpret_cast<uv_handle_t*>(&lagTimer_), static_cast<uv_close_cb>(onClose));
+}
+
+bool LoopMonitor::isRunning() const {
+	return running_;
+}
+
+LoopMonitor::Stats LoopMonitor::getStats() const {
+	return { iterations_.load(std::memory_order_relaxed),
+			lagWarnings_.load(std::memory_order_relaxed),
+			iterationUs_.snapshot(),
+			pollWaitUs_.snapshot(),
+			processingUs_.snapshot(),
+			lagUs_.snapshot() };
+}
+
+void LoopMonitor::resetStats() {
+	iterations_.store(0, std::memory_order_relaxed);
+	lagWarnings_.store(0, std::memory_order_relaxed);
+	iterationUs_.reset();
+	pollWaitUs_.reset();
+	processingUs_.reset();
+	lagUs_.reset();
+}
+
+uint64_t LoopMonitor::idleTimeNs() {
+#if defined(NDCP_UV_IDLE_TIME)
+	return uv_metrics_idle_time(loop_);
+#else
+	return 0;
+#endif
+}
+
+void LoopMonitor::armLagTimer() {
+	if (!running_ || options_.lagIntervalMs == 0)
+		return;
+	// libuv fires the timer once the loop time, in whole ms, reaches this.
+	lagDueNs_ = (uv_now(loop_) + options_.lagIntervalMs) * 1000000u;
+	uv_timer_start(&lagTimer_, static_cast<uv_timer_cb>(onLagTimer),
+			options_.lagIntervalMs, 0);
+}
+
+// Runs right before the loop blocks for I/O.
+void LoopMonitor::onPrepare(uv_prepare_t *handle) {
+	auto *monitor = static_cast<LoopMonitor*>(handle->data);
+	uint64_t now = uv_hrtime();
+	uint64_t idle = monitor->idleTimeNs();
+
+	if (monitor->prepareNs_ != 0) {
+		uint64_t iteration = now - monitor->prepareNs_;
+		uint64_t pollWait;
+#if defined(NDCP_UV_IDLE_TIME)
+		pollWait = idle - monitor->idleNs_;
+#else
+		// Also counts the I/O callbacks, which run within the poll.
+		pollWait = monitor->checkNs_ > monitor->prepareNs_
+				? monitor->checkNs_ - monitor->prepareNs_ : 0;
+#endif
+		if (pollWait > iteration)
+			pollWait = iteration;
+		monitor->iterationUs_.record(iteration / 1000);
+		monitor->pollWaitUs_.record(pollWait / 1000);
+		monitor->processingUs_.record((iteration - pollWait) / 1000);
+		monitor->iterations_.fetch_add(1, std::memory_order_relaxed);
+	}
+	monitor->prepareNs_ = now;
+	monitor->idleNs_ = idle;
+}
+
+// Runs right after the poll and its I/O callbacks.
+void LoopMonitor::onCheck(uv_check_t *handle) {
+	auto *monitor = static_cast<LoopMonitor*>(handle->data);
+	monitor->checkNs_ = uv_hrtime();
+}
+
+void LoopMonitor::onLagTimer(uv_timer_t *handle) {
+	auto *monitor = static_cast<LoopMonitor*>(handle->data);
+	uint64_t now = uv_hrtime();
+	uint64_t lag = now > monitor->lagDueNs_ ? now - monitor->lagDueNs_ : 0;
+	monitor->lagUs_.record(lag / 1000);
+
+	uint64_t warnNs = monitor->options_.lagWarnMs * 1000000u;
+	if (warnNs != 0 && lag >= warnNs) {
+		monitor->lagWarnings_.fetch_add(1, std::memory_order_relaxed);
+		LOG_EVERY_T(tuya::LS_WARNING, 1) << "loop " << monitor->name_
+				<< " is lagging, a timer fired " << lag / 1000000 << " ms late";
+	}
+	monitor->armLagTimer();
+}
+
+void LoopMonitor::onClose(uv_handle_t *handle) {
+	auto *monitor = static_cast<LoopMonitor*>(handle->data);
+	monitor->closing_--;
+}
+
+} // namespace ndcp
@@ -0,0 +1,89 @@
+#ifndef __NDCP_LOOP_MONITOR_H__
+#define __NDCP_LOOP_MONITOR_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "uv.h"
+#include "Histogram.h"
+
+namespace ndcp {
+
+/*
+ * Measures how busy a loop is, from uv_prepare_t / uv_check_t hooks around
+ * the poll and a timer that checks how late it fires.
+ *
+ * Per iteration, in microseconds: the whole iteration (prepare to prepare),
+ * the time blocked waiting for I/O, and what is left, the time spent
+ * running callbacks. The lag timer measures scheduling lag: how long a
+ * callback due now waits because the loop is busy with others.
+ *
+ * The handles are unreferenced, a monitor doesn't keep its loop alive.
+ * start() and stop() on the loop thread, getStats() from any thread.
+ */
+class LoopMonitor {
+public:
+	struct Options {
+		// Lag timer period, 0 disables lag measurement.
+		uint64_t lagIntervalMs { 100 };
+		// Log a warning when the lag timer fires that late, 0 never warns.
+		uint64_t lagWarnMs { 50 };
+	};
+
+	struct Stats {
+		uint64_t iterations;
+		uint64_t lagWarnings;
+		Histogram::Snapshot iterationUs;
+		Histogram::Snapshot pollWaitUs;
+		Histogram::Snapshot processingUs;
+		Histogram::Snapshot lagUs;
+	};
+
+	LoopMonitor() = default;
+	LoopMonitor(const LoopMonitor&) = delete;
+	LoopMonitor& operator=(const LoopMonitor&) = delete;
+
+	// |name| shows in the lag warnings.
+	int start(uv_loop_t *loop, const Options &options, const std::string &name);
+	void stop();
+	bool isRunning() const;
+
+	Stats getStats() const;
+	void resetStats();
+
+private:
+	static void onPrepare(uv_prepare_t *handle);
+	static void onCheck(uv_check_t *handle);
+	static void onLagTimer(uv_timer_t *handle);
+	static void onClose(uv_handle_t *handle);
+
+	void armLagTimer();
+	uint64_t idleTimeNs();
+
+private:
+	uv_loop_t *loop_ { nullptr };
+	Options options_;
+	std::string name_;
+	uv_prepare_t prepare_;
+	uv_check_t check_;
+	uv_timer_t lagTimer_;
+	bool running_ { false };
+	int closing_ { 0 };
+
+	// Loop thread only.
+	uint64_t prepareNs_ { 0 };
+	uint64_t checkNs_ { 0 };
+	uint64_t idleNs_ { 0 };
+	uint64_t lagDueNs_ { 0 };
+
+	std::atomic<uint64_t> iterations_ { 0 };
+	std::atomic<uint64_t> lagWarnings_ { 0 };
+	Histogram iterationUs_;
+	Histogram pollWaitUs_;
+	Histogram processingUs_;
+	Histogram lagUs_;
+};
+
+} // namespace ndcp
+
+#endif //__NDCP_LOOP_MONITOR_H__
@@ -0,0 +1,278 @@
+#include "LoopWatchdog.h"
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <chrono>
+#include "StackTrace.h"
+#include "../logger/Logging.h"
+#include "../logger/ThreadTypes.h"
+
+namespace ndcp {
+
+#if !defined(WIN)
+static constexpr int kMaxFrames = 64;
+// How long the loop thread gets to answer the signal.
+static constexpr int kCaptureTimeoutMs = 100;
+
+/* The stack being taken, one at a time process wide. */
+struct StackRequest {
+	enum { kIdle, kRequested, kCapturing, kDone };
+	std::atomic<int> state { kIdle };
+	std::atomic<pthread_t> target;
+	void *frames[kMaxFrames];
+	int count { 0 };
+};
+
+static StackRequest g_stackRequest;
+static std::mutex g_stackMutex;
+static uint64_t g_installedSignals { 0 };
+
+static void onStackSignal(int /*signal*/) {
+	int savedErrno = errno;
+	StackRequest &request = g_stackRequest;
+	int expected = StackRequest::kRequested;
+	if (request.state.load(std::memory_order_acquire) == StackRequest::kRequested &&
+			pthread_equal(pthread_self(), request.target.load(std::memory_order_relaxed)) &&
+			request.state.compare_exchange_strong(expected, StackRequest::kCapturing,
+					std::memory_order_acquire)) {
+		// Leave out this handler.
+		request.count = captureStack(request.frames, kMaxFrames, 1);
+		request.state.store(StackRequest::kDone, std::memory_order_release);
+	}
+	errno = savedErrno;
+}
+
+// Called with g_stackMutex held.
+static bool installStackSignal(int signal) {
+	if (signal <= 0 || signal >= 64)
+		return false;
+	if (g_installedSignals & (uint64_t(1) << signal))
+		return true;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onStackSignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(signal, &action, nullptr) != 0)
+		return false;
+	g_installedSignals |= uint64_t(1) << signal;
+	return true;
+}
+#endif
+
+static inline uint64_t nextOdd(uint64_t beat) {
+	return (beat + 1) | 1;
+}
+
+static inline uint64_t nextEven(uint64_t beat) {
+	return (beat | 1) + 1;
+}
+
+LoopWatchdog::~LoopWatchdog() {
+	if (thread_.joinable()) {
+		{
+			std::lock_guard<std::mutex> _(mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_one();
+		thread_.join();
+	}
+}
+
+int LoopWatchdog::start(uv_loop_t *loop, const Options &options, const std::string &name) {
+	if (running_ || closing_ != 0)
+		return UV_EBUSY;
+
+	loop_ = loop;
+	options_ = options;
+	name_ = name;
+	stopping_ = false;
+	stalled_ = 0;
+#if !defined(WIN)
+	if (options_.signal == 0)
+		options_.signal = SIGUSR2;
+	loopThread_ = pthread_self();
+	if (options_.captureStack) {
+		std::lock_guard<std::mutex> _(g_stackMutex);
+		if (!installStackSignal(options_.signal))
+			return UV_EINVAL;
+		// The unwinder loads on first use, which must not be in the handler.
+		void *frames[1];
+		captureStack(frames, 1);
+	}
+#endif
+	heartbeat_.store(nextOdd(heartbeat_.load(std::memory_order_relaxed)),
+			std::memory_order_release);
+
+	int err = uv_async_init(loop, &probe_, static_cast<uv_async_cb>(onProbe));
+	if (err != 0)
+		return err;
+	probe_.data = this;
+	uv_unref(reinterpret_cast<uv_handle_t*>(&probe_));
+
+	// Never fails in libuv.
+	uv_check_init(loop, &check_);
+	check_.data = this;
+	uv_check_start(&check_, static_cast<uv_check_cb>(onCheck));
+	uv_unref(reinterpret_cast<uv_handle_t*>(&check_));
+
+	running_ = true;
+	thread_ = std::thread(&LoopWatchdog::run, this);
+	return 0;
+}
+
+void LoopWatchdog::stop() {
+	if (!running_)
+		return;
+	running_ = false;
+	{
+		std::lock_guard<std::mutex> _(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+
+	closing_ = 2;
+	uv_close(reinterpret_cast<uv_handle_t*>(&probe_), static_cast<uv_close_cb>(onClose));
+	uv_close(reinterpret_cast<uv_handle_t*>(&check_), static_cast<uv_close_cb>(onClose));
+}
+
+bool LoopWatchdog::isRunning() const {
+	return running_;
+}
+
+void LoopWatchdog::resume() {
+	heartbeat_.store(nextEven(heartbeat_.load(std::memory_order_relaxed)),
+			std::memory_order_release);
+}
+
+void LoopWatchdog::pause() {
+	heartbeat_.store(nextOdd(heartbeat_.load(std::memory_order_relaxed)),
+			std::memory_order_release);
+}
+
+LoopWatchdog::Stats LoopWatchdog::getStats() const {
+	return { stalls_.load(std::memory_order_relaxed),
+			longestStallMs_.load(std::memory_order_relaxed),
+			stalled_.load(std::memory_order_relaxed) };
+}
+
+void LoopWatchdog::onProbe(uv_async_t *handle) {
+	auto *watchdog = static_cast<LoopWatchdog*>(handle->data);
+	watchdog->heartbeat_.store(nextEven(watchdog->heartbeat_.load(std::memory_order_relaxed)),
+			std::memory_order_release);
+}
+
+void LoopWatchdog::onCheck(uv_check_t *handle) {
+	auto *watchdog = static_cast<LoopWatchdog*>(handle->data);
+	watchdog->heartbeat_.store(nextEven(watchdog->heartbeat_.load(std::memory_order_relaxed)),
+			std::memory_order_release);
+}
+
+void LoopWatchdog::onClose(uv_handle_t *handle) {
+	auto *watchdog = static_cast<LoopWatchdog*>(handle->data);
+	watchdog->closing_--;
+}
+
+void LoopWatchdog::run() {
+	tuya::SetCurrentThreadName(("watchdog-" + name_).c_str());
+
+	const uint64_t stallNs = options_.stallMs * 1000000u;
+	uint64_t intervalMs = options_.checkIntervalMs;
+	if (intervalMs == 0)
+		intervalMs = options_.stallMs / 4 > 0 ? options_.stallMs / 4 : 1;
+
+	uint64_t lastBeat = heartbeat_.load(std::memory_order_acquire);
+	uint64_t probeNs = 0;
+	bool reported = false;
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!stopping_) {
+		wake_.wait_for(lock, std::chrono::milliseconds(intervalMs));
+		if (stopping_)
+			break;
+
+		uint64_t beat = heartbeat_.load(std::memory_order_acquire);
+		uint64_t now = uv_hrtime();
+		uint64_t stalledMs = probeNs != 0 ? (now - probeNs) / 1000000u : 0;
+		if (beat != lastBeat) {
+			if (reported) {
+				LOGW << "loop " << name_ << " was stalled for " << stalledMs << " ms";
+				stalled_.store(0, std::memory_order_relaxed);
+				reported = false;
+			}
+			lastBeat = beat;
+			probeNs = 0;
+			continue;
+		}
+		// Odd: not running the loop.
+		if ((beat & 1) != 0)
+			continue;
+		// Maybe just idle in the poll, which the probe ends.
+		if (probeNs == 0) {
+			probeNs = now;
+			uv_async_send(&probe_);
+			continue;
+		}
+		if (now - probeNs < stallNs)
+			continue;
+
+		if (stalledMs > longestStallMs_.load(std::memory_order_relaxed))
+			longestStallMs_.store(stalledMs, std::memory_order_relaxed);
+		if (!reported) {
+			reported = true;
+			stalls_.fetch_add(1, std::memory_order_relaxed);
+			stalled_.store(1, std::memory_order_relaxed);
+			lock.unlock();
+			report(stalledMs);
+			lock.lock();
+		}
+	}
+}
+
+void LoopWatchdog::report(uint64_t stalledMs) {
+	std::string stack;
+	if (options_.captureStack)
+		stack = captureLoopStack();
+
+	if (stack.empty()) {
+		LOGW << "loop " << name_ << " stalled for over " << stalledMs << " ms";
+	} else {
+		LOGW << "loop " << name_ << " stalled for over " << stalledMs << " ms, running:\n"
+				<< stack;
+	}
+}
+
+std::string LoopWatchdog::captureLoopStack() {
+#if defined(WIN)
+	return std::string();
+#else
+	std::lock_guard<std::mutex> _(g_stackMutex);
+	StackRequest &request = g_stackRequest;
+	request.target.store(loopThread_, std::memory_order_relaxed);
+	request.count = 0;
+	request.state.store(StackRequest::kRequested, std::memory_order_release);
+
+	int count = 0;
+	if (pthread_kill(loopThread_, options_.signal) == 0) {
+		for (int waitedMs = 0; waitedMs < kCaptureTimeoutMs; waitedMs++) {
+			if (request.state.load(std::memory_order_acquire) == StackRequest::kDone)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	// Withdraw the request, unless the handler is already on it.
+	int expected = StackRequest::kRequested;
+	if (!request.state.compare_exchange_strong(expected, StackRequest::kIdle)) {
+		while (request.state.load(std::memory_order_acquire) != StackRequest::kDone)
+			std::this_thread::yield();
+		count = request.count;
+	}
+	request.state.store(StackRequest::kIdle, std::memory_order_relaxed);
+	return symbolizeStack(request.frames, count);
+#endif
+}
+
+} // namespace ndcp
@@ -0,0 +1,109 @@
+#ifndef __NDCP_LOOP_WATCHDOG_H__
+#define __NDCP_LOOP_WATCHDOG_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#if !defined(WIN)
+#include <pthread.h>
+#endif
+#include "uv.h"
+
+namespace ndcp {
+
+/*
+ * Notices a loop thread stuck in a callback, from a thread of its own.
+ *
+ * The loop bumps a heartbeat every iteration. When the heartbeat stops,
+ * the watchdog wakes the loop with an async probe: a loop idle in the poll
+ * answers it right away. If the probe goes unanswered for stallMs, the
+ * watchdog interrupts the loop thread with |signal|, has it record its own
+ * stack from the signal handler, and logs the symbolized stack. It logs
+ * again once the loop moves on, with how long it was stuck.
+ *
+ * An idle loop is thus woken about every two check intervals.
+ *
+ * Stacks need POSIX signals; elsewhere the stall is logged without one.
+ * The signal handler is installed with SA_RESTART, so the interrupted
+ * system calls go on.
+ */
+class LoopWatchdog {
+public:
+	struct Options {
+		// How long the loop may leave a probe unanswered before it counts as
+		// a stall.
+		uint64_t stallMs { 200 };
+		// How often the watchdog looks, 0 means stallMs / 4.
+		uint64_t checkIntervalMs { 0 };
+		bool captureStack { true };
+		// Delivered to the loop thread to capture its stack, 0 for SIGUSR2.
+		int signal { 0 };
+	};
+
+	struct Stats {
+		uint64_t stalls;
+		uint64_t longestStallMs;
+		// Stalls still going on when last checked, 0 or 1.
+		uint64_t stalled;
+	};
+
+	LoopWatchdog() = default;
+	~LoopWatchdog();
+
+	LoopWatchdog(const LoopWatchdog&) = delete;
+	LoopWatchdog& operator=(const LoopWatchdog&) = delete;
+
+	// On the loop thread: that's the thread the stacks are taken from.
+	int start(uv_loop_t *loop, const Options &options, const std::string &name);
+	// On the loop thread, joins the watchdog thread.
+	void stop();
+	bool isRunning() const;
+
+	// Around uv_run() on the loop thread: what the thread does while not
+	// running the loop is no stall. Starts out paused, the first iteration
+	// resumes it otherwise.
+	void resume();
+	void pause();
+
+	Stats getStats() const;
+
+private:
+	static void onProbe(uv_async_t *handle);
+	static void onCheck(uv_check_t *handle);
+	static void onClose(uv_handle_t *handle);
+
+	void run();
+	void report(uint64_t stalledMs);
+	std::string captureLoopStack();
+
+private:
+	uv_loop_t *loop_ { nullptr };
+	Options options_;
+	std::string name_;
+	uv_async_t probe_;
+	uv_check_t check_;
+	bool running_ { false };
+	int closing_ { 0 };
+#if !defined(WIN)
+	pthread_t loopThread_;
+#endif
+
+	// Even while the loop runs, odd once paused.
+	std::atomic<uint64_t> heartbeat_ { 1 };
+
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	bool stopping_ { false };
+
+	std::atomic<uint64_t> stalls_ { 0 };
+	std::atomic<uint64_t> longestStallMs_ { 0 };
+	std::atomic<uint64_t> stalled_ { 0 };
+};
+
+} // namespace ndcp
+
+#endif //__NDCP_LOOP_WATCHDOG_H__
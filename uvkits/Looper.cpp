@@ -1,43 +1,277 @@
 #include "Looper.h"
 #include <cstdlib> // std::abort()
+#include <stdio.h>
 #include "uv.h"
+#include "../logger/ThreadTypes.h"
 
 namespace ndcp {
 
+/* Static variables. */
 
+Looper *Looper::main_ { nullptr };
+static thread_local Looper *current_ { nullptr };
 
-/* Static variables. */
+inline static void onCloseWalk(uv_handle_t *handle, void* /*arg*/) {
+	if (!uv_is_closing(handle))
+		uv_close(handle, nullptr);
+}
 
-uv_loop_t *Looper::loop_ { nullptr };
+/* Instance methods. */
 
-/* Static methods. */
+Looper::Looper() {
+}
 
-void Looper::init() {
+Looper::~Looper() {
+	if (threadRunning_)
+		stop();
+	else if (opened_)
+		detach();
+}
+
+int Looper::attach() {
+	if (opened_ || threadRunning_ || current_ != nullptr)
+		return UV_EBUSY;
+	return open(false);
+}
+
+void Looper::run() {
+	if (opened_) {
+		watchdog_.resume();
+		uv_run(&loop_, UV_RUN_DEFAULT);
+		watchdog_.pause();
+	}
+}
+
+void Looper::detach() {
+	if (opened_)
+		close(false);
+}
+
+int Looper::start(const char *name, std::function<int()> setup) {
+	if (opened_ || threadRunning_)
+		return UV_EBUSY;
+
+	int err = -1;
+	do {
+		name_ = name != nullptr ? name : "";
+		setup_ = std::move(setup);
+		stopping_ = false;
+		err = uv_sem_init(&started_, 0);
+		if (err != 0)
+			break;
+
+		err = uv_thread_create(&thread_, runThread, this);
+		if (err != 0) {
+			uv_sem_destroy(&started_);
+			break;
+		}
+		uv_sem_wait(&started_);
+		uv_sem_destroy(&started_);
+		setup_ = nullptr;
+
+		err = startError_;
+		if (err != 0) {
+			uv_thread_join(&thread_);
+			break;
+		}
+		threadRunning_ = true;
+	} while(0);
+
+	return err;
+}
+
+void Looper::stop() {
+	if (!threadRunning_)
+		return;
+	// Queued behind what was posted before.
+	tasks_.post([this]() {
+		stopping_ = true;
+		uv_stop(&loop_);
+	});
+	uv_thread_join(&thread_);
+	threadRunning_ = false;
+}
+
+void Looper::runThread(void *arg) {
+	auto *looper = static_cast<Looper*>(arg);
+	if (!looper->name_.empty())
+		tuya::SetCurrentThreadName(looper->name_.c_str());
+
+	int err = looper->open(true);
+	if (err == 0 && looper->setup_)
+		err = looper->setup_();
+	if (err != 0 && looper->opened_)
+		looper->close(true);
+	looper->startError_ = err;
+	uv_sem_post(&looper->started_);
+	if (err != 0)
+		return;
+
+	// The task queue holds the loop, uv_run() only returns when stopped,
+	// unless someone else stopped it.
+	looper->watchdog_.resume();
+	while (!looper->stopping_)
+		uv_run(&looper->loop_, UV_RUN_DEFAULT);
+	looper->watchdog_.pause();
+	looper->close(true);
+}
+
+int Looper::open(bool keepAlive) {
 	// NOTE: Logger depends on this so we cannot log anything here.
+	int err = -1;
+	do {
+		err = uv_loop_init(&loop_);
+		if (err != 0) {
+			printf("libuv initialization failed: %s\n", uv_strerror(err));
+			break;
+		}
 
-	Looper::loop_ = new uv_loop_t;
+		err = tasks_.init(&loop_, keepAlive);
+		if (err != 0) {
+			printf("task queue initialization failed: %s\n", uv_strerror(err));
+			uv_loop_close(&loop_);
+			break;
+		}
+		opened_ = true;
+		current_ = this;
+	} while(0);
 
-	int err = uv_loop_init(Looper::loop_);
+	return err;
+}
 
-	if (err != 0) {
-		printf("libuv initialization failed\n");
+void Looper::close(bool closeHandles) {
+	watchdog_.stop();
+	monitor_.stop();
+	tasks_.close();
+	if (closeHandles) {
+		// Run the close callbacks of everything that was left.
+		uv_walk(&loop_, onCloseWalk, nullptr);
+		uv_run(&loop_, UV_RUN_DEFAULT);
+	} else {
+		// Let the close callbacks run.
+		uv_run(&loop_, UV_RUN_NOWAIT);
 	}
+	int err = uv_loop_close(&loop_);
+	if (err != 0)
+		printf("closing loop %s: %s\n", name_.c_str(), uv_strerror(err));
+	opened_ = false;
+	if (current_ == this)
+		current_ = nullptr;
 }
 
-void Looper::destory() {
-	if (Looper::loop_ != nullptr) {
-		uv_loop_close(Looper::loop_);
-		delete Looper::loop_;
+uv_loop_t* Looper::getLoop() {
+	return opened_ ? &loop_ : nullptr;
+}
+
+const std::string& Looper::getName() const {
+	return name_;
+}
+
+bool Looper::isCurrent() const {
+	return current_ == this;
+}
+
+bool Looper::post(std::function<void()> task) {
+	return tasks_.post(std::move(task));
+}
+
+bool Looper::postDelayed(std::function<void()> task, uint64_t delayMs) {
+	return tasks_.postDelayed(std::move(task), delayMs);
+}
+
+bool Looper::post(TaskQueue::Node *node) {
+	return tasks_.post(node);
+}
+
+TaskQueue::Stats Looper::getStats() const {
+	return tasks_.getStats();
+}
+
+void Looper::hold() {
+	tasks_.hold();
+}
+
+void Looper::release() {
+	tasks_.release();
+}
+
+int Looper::startMonitor(const LoopMonitor::Options &options) {
+	if (!opened_)
+		return UV_EINVAL;
+	return monitor_.start(&loop_, options, name_);
+}
+
+void Looper::stopMonitor() {
+	monitor_.stop();
+}
+
+LoopMonitor::Stats Looper::getMonitorStats() const {
+	return monitor_.getStats();
+}
+
+int Looper::startWatchdog(const LoopWatchdog::Options &options) {
+	if (!opened_)
+		return UV_EINVAL;
+	return watchdog_.start(&loop_, options, name_);
+}
+
+void Looper::stopWatchdog() {
+	watchdog_.stop();
+}
+
+LoopWatchdog::Stats Looper::getWatchdogStats() const {
+	return watchdog_.getStats();
+}
+
+/* Static methods. */
+
+Looper* Looper::current() {
+	return current_;
+}
+
+Looper* Looper::getMain() {
+	if (main_ == nullptr) {
+		Looper::init();
 	}
+	return main_;
 }
 
+void Looper::init() {
+	if (main_ != nullptr)
+		return;
+
+	Looper *looper = new Looper;
+	looper->name_ = "main";
+	if (looper->attach() != 0) {
+		delete looper;
+		return;
+	}
+	main_ = looper;
+}
 
+void Looper::destory() {
+	if (main_ != nullptr) {
+		delete main_;
+		main_ = nullptr;
+	}
+}
 
 void Looper::loop() {
-	// This should never happen.
-	//printf(Looper::loop_ != nullptr, "loop unset");
+	Looper *looper = Looper::getMain();
+	if (looper != nullptr)
+		looper->run();
+}
+
+bool Looper::postTask(std::function<void()> task) {
+	return main_ != nullptr && main_->post(std::move(task));
+}
+
+bool Looper::postDelayedTask(std::function<void()> task, uint64_t delayMs) {
+	return main_ != nullptr && main_->postDelayed(std::move(task), delayMs);
+}
 
-	uv_run(Looper::loop_, UV_RUN_DEFAULT);
+TaskQueue::Stats Looper::getTaskStats() {
+	return main_ != nullptr ? main_->getStats() : TaskQueue::Stats {};
 }
 
 
@@ -2,31 +2,132 @@
 #define __OSCP_LOOPER_H__
 
 #include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
 #include "uv.h"
+#include "LoopMonitor.h"
+#include "LoopWatchdog.h"
+#include "TaskQueue.h"
 
 namespace ndcp {
 
+/*
+ * An event loop and the thread that owns it. A thread owns at most one
+ * Looper, which is its current() one; everything living on the loop is
+ * touched from that thread only, other threads post() to it.
+ *
+ * A Looper is either attached to the calling thread, which then drives it
+ * with run(), or runs on a thread of its own between start() and stop().
+ *
+ * The static methods work on the process-wide main Looper, attached to the
+ * thread that first calls init() or getLooper().
+ */
 class Looper {
 public:
+	Looper();
+	// Must run on the owning thread, or after stop().
+	~Looper();
+
+	Looper(const Looper&) = delete;
+	Looper& operator=(const Looper&) = delete;
+
+	// Sets the loop up on the calling thread, which owns it from then on.
+	// Fails if the thread already owns a Looper.
+	int attach();
+	// Runs the loop until it has nothing left to do. Owning thread only.
+	void run();
+	// Closes the task queue and the loop, after run() returned. Owning
+	// thread only.
+	void detach();
+
+	// Spawns a thread which owns the loop and runs it until stop(). |setup|,
+	// if given, runs on that thread before the loop does; start() waits for
+	// it and returns its error, the thread is gone again on failure.
+	int start(const char *name = nullptr, std::function<int()> setup = nullptr);
+	// Stops the thread of start() and waits for it. Tasks posted before run,
+	// handles still open on the loop are closed. Not from that thread.
+	void stop();
+
+	// nullptr until attach() or start().
+	uv_loop_t* getLoop();
+	const std::string& getName() const;
+	bool isCurrent() const;
+
+	// Run |task| on the owning thread, in posting order; callable from any
+	// thread. The loop must be running, or kept alive by other handles, for
+	// tasks to run. Return false when the task was dropped: before attach()
+	// or start(), or after detach() or stop().
+	bool post(std::function<void()> task);
+	bool postDelayed(std::function<void()> task, uint64_t delayMs);
+	// Takes |node| over, see TaskQueue::Node.
+	bool post(TaskQueue::Node *node);
+	TaskQueue::Stats getStats() const;
+	// Keep run() from returning while a task is yet to be posted from
+	// elsewhere, see TaskQueue::hold(). Owning thread only.
+	void hold();
+	void release();
+
+	// Measures iteration times and scheduling lag, see LoopMonitor. Owning
+	// thread only, e.g. from the |setup| of start(). The stats can be read
+	// from any thread, they stay zero while the monitor is off.
+	int startMonitor(const LoopMonitor::Options &options = LoopMonitor::Options());
+	void stopMonitor();
+	LoopMonitor::Stats getMonitorStats() const;
+
+	// Logs the stack of callbacks that block the loop, see LoopWatchdog.
+	// Owning thread only, like startMonitor().
+	int startWatchdog(const LoopWatchdog::Options &options = LoopWatchdog::Options());
+	void stopWatchdog();
+	LoopWatchdog::Stats getWatchdogStats() const;
+
+	// The Looper owned by the calling thread, nullptr if none.
+	static Looper* current();
+	// The main Looper, attached to the calling thread on first use.
+	static Looper* getMain();
+
+	/* Main Looper. */
 	static void init();
 	static void destory();
 	static void loop();
 	static uv_loop_t* getLooper();
+	static bool postTask(std::function<void()> task);
+	static bool postDelayedTask(std::function<void()> task, uint64_t delayMs);
+	static TaskQueue::Stats getTaskStats();
+
 	static uint64_t getTimeMs();
 	static uint64_t getTimeUs();
 	static uint64_t getTimeNs();
 
 private:
-	static uv_loop_t *loop_;
+	int open(bool keepAlive);
+	void close(bool closeHandles);
+	static void runThread(void *arg);
+
+private:
+	uv_loop_t loop_;
+	bool opened_ { false };
+	TaskQueue tasks_;
+	LoopMonitor monitor_;
+	LoopWatchdog watchdog_;
+	std::string name_;
+
+	// start() / stop().
+	uv_thread_t thread_;
+	bool threadRunning_ { false };
+	std::atomic<bool> stopping_ { false };
+	uv_sem_t started_;
+	std::function<int()> setup_;
+	int startError_ { 0 };
+
+	static Looper *main_;
 };
 
 /* Inline static methods. */
 
 inline uv_loop_t* Looper::getLooper() {
-	if (loop_ == nullptr) {
-		Looper::init();
-	}
-	return Looper::loop_;
+	Looper *looper = Looper::getMain();
+	return looper != nullptr ? looper->getLoop() : nullptr;
 }
 
 inline uint64_t Looper::getTimeMs() {
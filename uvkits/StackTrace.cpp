@@ -0,0 +1,105 @@
+#include "StackTrace.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(WIN)
+#include <windows.h>
+#else
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <unwind.h>
+#endif
+
+namespace ndcp {
+
+static constexpr int kMaxFrames = 64;
+
+#if !defined(WIN)
+/* State of one _Unwind_Backtrace() walk. */
+struct UnwindState {
+	void **frames;
+	int maxFrames;
+	int skip;
+	int count;
+};
+
+static _Unwind_Reason_Code onUnwindFrame(struct _Unwind_Context *context, void *arg) {
+	auto *state = static_cast<UnwindState*>(arg);
+	uintptr_t pc = _Unwind_GetIP(context);
+	if (pc == 0)
+		return _URC_END_OF_STACK;
+	if (state->skip > 0) {
+		state->skip--;
+		return _URC_NO_REASON;
+	}
+	state->frames[state->count++] = reinterpret_cast<void*>(pc);
+	return state->count < state->maxFrames ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+#endif
+
+int captureStack(void **frames, int maxFrames, int skip) {
+	if (maxFrames <= 0)
+		return 0;
+#if defined(WIN)
+	return CaptureStackBackTrace(static_cast<DWORD>(skip + 1), static_cast<DWORD>(maxFrames),
+			frames, nullptr);
+#else
+	// Leave out this frame too.
+	UnwindState state { frames, maxFrames, skip + 1, 0 };
+	_Unwind_Backtrace(onUnwindFrame, &state);
+	return state.count;
+#endif
+}
+
+std::string symbolizeStack(void *const *frames, int count) {
+	std::string trace;
+	char line[512];
+	for (int i = 0; i < count; i++) {
+		uintptr_t pc = reinterpret_cast<uintptr_t>(frames[i]);
+#if defined(WIN)
+		snprintf(line, sizeof(line), "#%02d 0x%llx\n", i,
+				static_cast<unsigned long long>(pc));
+#else
+		// Return addresses point past the call, look up the call itself.
+		Dl_info info;
+		if (dladdr(reinterpret_cast<void*>(pc > 0 ? pc - 1 : pc), &info) == 0) {
+			snprintf(line, sizeof(line), "#%02d 0x%llx\n", i,
+					static_cast<unsigned long long>(pc));
+			trace += line;
+			continue;
+		}
+
+		const char *module = info.dli_fname != nullptr ? info.dli_fname : "?";
+		const char *slash = strrchr(module, '/');
+		if (slash != nullptr)
+			module = slash + 1;
+		uintptr_t moduleOffset = pc - reinterpret_cast<uintptr_t>(info.dli_fbase);
+
+		if (info.dli_sname != nullptr) {
+			int status = -1;
+			char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			snprintf(line, sizeof(line), "#%02d 0x%llx %s+0x%llx (%s+0x%llx)\n", i,
+					static_cast<unsigned long long>(pc),
+					status == 0 ? demangled : info.dli_sname,
+					static_cast<unsigned long long>(pc - reinterpret_cast<uintptr_t>(info.dli_saddr)),
+					module, static_cast<unsigned long long>(moduleOffset));
+			free(demangled);
+		} else {
+			snprintf(line, sizeof(line), "#%02d 0x%llx (%s+0x%llx)\n", i,
+					static_cast<unsigned long long>(pc), module,
+					static_cast<unsigned long long>(moduleOffset));
+		}
+#endif
+		trace += line;
+	}
+	return trace;
+}
+
+std::string currentStackTrace(int skip) {
+	void *frames[kMaxFrames];
+	int count = captureStack(frames, kMaxFrames, skip + 1);
+	return symbolizeStack(frames, count);
+}
+
+} // namespace ndcp
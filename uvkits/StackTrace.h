@@ -0,0 +1,33 @@
+#ifndef __NDCP_STACK_TRACE_H__
+#define __NDCP_STACK_TRACE_H__
+
+#include <string>
+
+namespace ndcp {
+
+/*
+ * Call stacks, captured as return addresses and turned into text later.
+ *
+ * captureStack() only walks the frames, without allocating or locking, so
+ * it may be called from a signal handler once captureStack() has run once
+ * outside of one (the unwinder loads lazily). symbolizeStack() is not
+ * signal safe.
+ *
+ * Symbols come from the dynamic symbol table: link with -rdynamic to see
+ * those of the executable, every frame also carries its module and offset
+ * for addr2line.
+ */
+
+// Stores up to |maxFrames| return addresses of the caller's stack, leaving
+// out the |skip| innermost frames, and returns how many were stored.
+int captureStack(void **frames, int maxFrames, int skip = 0);
+
+// One line per frame: "#03 0x55d0c1a2b3c4 ndcp::Foo::bar()+0x24 (libx.so+0x1b3c4)".
+std::string symbolizeStack(void *const *frames, int count);
+
+// Both of the above, for the calling thread.
+std::string currentStackTrace(int skip = 0);
+
+} // namespace ndcp
+
+#endif //__NDCP_STACK_TRACE_H__
@@ -0,0 +1,219 @@
+#include "TaskQueue.h"
+#include "Looper.h"
+#include <thread>
+
+namespace ndcp {
+
+TaskQueue::~TaskQueue() {
+	Node *task = head_.exchange(nullptr);
+	while (task != nullptr) {
+		Node *next = task->next;
+		delete task;
+		task = next;
+	}
+	while (!delayed_.empty()) {
+		delete delayed_.top().task;
+		delayed_.pop();
+	}
+}
+
+int TaskQueue::init(uv_loop_t *loop, bool keepAlive) {
+	int err = -1;
+	do {
+		loop_ = loop;
+		loopThread_ = uv_thread_self();
+		err = uv_async_init(loop, &async_, static_cast<uv_async_cb>(onAsync));
+		if (err != 0)
+			break;
+		async_.data = this;
+		// Queued posts alone don't keep the loop running.
+		keepAlive_ = keepAlive;
+		holds_ = 0;
+		if (!keepAlive)
+			uv_unref(reinterpret_cast<uv_handle_t*>(&async_));
+
+		err = uv_timer_init(loop, &timer_);
+		if (err != 0) {
+			uv_close(reinterpret_cast<uv_handle_t*>(&async_), nullptr);
+			break;
+		}
+		timer_.data = this;
+		accepting_.store(true, std::memory_order_release);
+	} while(0);
+
+	return err;
+}
+
+void TaskQueue::close(std::function<void()> onClosed) {
+	if (!accepting_.exchange(false) || closing_ != 0)
+		return;
+	// A post that got past the check still sends on the async handle.
+	while (producers_.load(std::memory_order_seq_cst) > 0)
+		std::this_thread::yield();
+
+	// What got in before runs, delayed tasks are dropped.
+	drain();
+	while (!delayed_.empty()) {
+		delete delayed_.top().task;
+		delayed_.pop();
+	}
+
+	onClosed_ = std::move(onClosed);
+	closing_ = 2;
+	uv_close(reinterpret_cast<uv_handle_t*>(&async_), static_cast<uv_close_cb>(onClose));
+	uv_close(reinterpret_cast<uv_handle_t*>(&timer_), static_cast<uv_close_cb>(onClose));
+}
+
+bool TaskQueue::post(std::function<void()> task) {
+	return push(new Task(std::move(task)));
+}
+
+bool TaskQueue::post(Node *node) {
+	node->dueMs = 0;
+	return push(node);
+}
+
+bool TaskQueue::postDelayed(std::function<void()> task, uint64_t delayMs) {
+	// At least 1 so it can't be taken for an immediate task.
+	uint64_t dueMs = Looper::getTimeMs() + delayMs;
+	Node *delayed = new Task(std::move(task));
+	delayed->dueMs = dueMs > 0 ? dueMs : 1;
+
+	uv_thread_t self = uv_thread_self();
+	if (!uv_thread_equal(&self, &loopThread_))
+		return push(delayed);
+
+	// On the loop: straight into the heap, so the timer holds the loop.
+	if (!accepting_.load(std::memory_order_relaxed)) {
+		delete delayed;
+		return false;
+	}
+	posted_.fetch_add(1, std::memory_order_relaxed);
+	delayed_.push({ delayed->dueMs, delayedSeq_++, delayed });
+	armTimer();
+	return true;
+}
+
+TaskQueue::Stats TaskQueue::getStats() const {
+	return { posted_.load(std::memory_order_relaxed),
+			wakeups_.load(std::memory_order_relaxed),
+			run_.load(std::memory_order_relaxed) };
+}
+
+void TaskQueue::hold() {
+	if (!accepting_.load(std::memory_order_relaxed))
+		return;
+	if (holds_++ == 0 && !keepAlive_)
+		uv_ref(reinterpret_cast<uv_handle_t*>(&async_));
+}
+
+void TaskQueue::release() {
+	if (holds_ == 0 || !accepting_.load(std::memory_order_relaxed))
+		return;
+	if (--holds_ == 0 && !keepAlive_)
+		uv_unref(reinterpret_cast<uv_handle_t*>(&async_));
+}
+
+bool TaskQueue::push(Node *task) {
+	producers_.fetch_add(1, std::memory_order_seq_cst);
+	if (!accepting_.load(std::memory_order_seq_cst)) {
+		producers_.fetch_sub(1, std::memory_order_release);
+		delete task;
+		return false;
+	}
+
+	Node *head = head_.load(std::memory_order_relaxed);
+	do {
+		task->next = head;
+	} while (!head_.compare_exchange_weak(head, task, std::memory_order_seq_cst,
+			std::memory_order_relaxed));
+
+	// Only the first post since the loop last looked sends the wakeup. Seeing
+	// it set is enough: drain() clears it before taking the stack.
+	if (!signaled_.load(std::memory_order_seq_cst) &&
+			!signaled_.exchange(true, std::memory_order_seq_cst))
+		uv_async_send(&async_);
+	producers_.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+void TaskQueue::drain() {
+	// Cleared before taking the stack: a post that lands after the exchange
+	// sends a new wakeup.
+	signaled_.store(false, std::memory_order_seq_cst);
+	Node *task = head_.exchange(nullptr, std::memory_order_seq_cst);
+
+	// The stack is newest first. Counted here rather than by every post.
+	Node *ordered = nullptr;
+	uint64_t taken = 0;
+	while (task != nullptr) {
+		Node *next = task->next;
+		task->next = ordered;
+		ordered = task;
+		task = next;
+		taken++;
+	}
+	posted_.fetch_add(taken, std::memory_order_relaxed);
+
+	uint64_t run = 0;
+	while (ordered != nullptr) {
+		Node *next = ordered->next;
+		if (ordered->dueMs != 0) {
+			delayed_.push({ ordered->dueMs, delayedSeq_++, ordered });
+		} else {
+			ordered->run();
+			delete ordered;
+			run++;
+		}
+		ordered = next;
+	}
+	run_.fetch_add(run, std::memory_order_relaxed);
+}
+
+void TaskQueue::runDue() {
+	uint64_t now = Looper::getTimeMs();
+	while (!delayed_.empty() && delayed_.top().dueMs <= now) {
+		Node *task = delayed_.top().task;
+		delayed_.pop();
+		task->run();
+		delete task;
+		run_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void TaskQueue::armTimer() {
+	if (closing_ != 0)
+		return;
+	if (delayed_.empty()) {
+		uv_timer_stop(&timer_);
+		return;
+	}
+	uint64_t now = Looper::getTimeMs();
+	uint64_t dueMs = delayed_.top().dueMs;
+	uv_timer_start(&timer_, static_cast<uv_timer_cb>(onTimer),
+			dueMs > now ? dueMs - now : 0, 0);
+}
+
+void TaskQueue::onAsync(uv_async_t *handle) {
+	auto *queue = static_cast<TaskQueue*>(handle->data);
+	queue->wakeups_.fetch_add(1, std::memory_order_relaxed);
+	queue->drain();
+	queue->runDue();
+	queue->armTimer();
+}
+
+void TaskQueue::onTimer(uv_timer_t *handle) {
+	auto *queue = static_cast<TaskQueue*>(handle->data);
+	queue->runDue();
+	queue->armTimer();
+}
+
+void TaskQueue::onClose(uv_handle_t *handle) {
+	auto *queue = static_cast<TaskQueue*>(handle->data);
+	if (--queue->closing_ == 0 && queue->onClosed_) {
+		auto onClosed = std::move(queue->onClosed_);
+		onClosed();
+	}
+}
+
+} // namespace ndcp
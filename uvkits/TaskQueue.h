@@ -0,0 +1,126 @@
+#ifndef __NDCP_TASK_QUEUE_H__
+#define __NDCP_TASK_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <vector>
+#include "uv.h"
+
+namespace ndcp {
+
+/*
+ * Runs closures posted from any thread on one loop.
+ *
+ * Posts go onto a lock-free intrusive stack (one CAS each); the loop takes
+ * the whole stack with one exchange and runs it in posting order. A post
+ * only calls uv_async_send() when the queue was idle, so a burst of posts
+ * costs the loop one wakeup. Delayed tasks are kept in a heap on the loop
+ * and driven by a single uv_timer_t.
+ *
+ * The async handle is unreferenced unless asked otherwise: pending posts
+ * don't keep uv_run() going on their own. Delayed tasks do once they're in the heap, which is
+ * right away when posted from the loop thread.
+ */
+class TaskQueue {
+public:
+	struct Stats {
+		// Taken in by the loop, counted when it drains the queue.
+		uint64_t posted;
+		uint64_t wakeups;
+		uint64_t run;
+	};
+
+	/* Something to run on the loop, posted as is, without allocating. */
+	struct Node {
+		virtual ~Node() = default;
+		virtual void run() = 0;
+		// Looper::getTimeMs() deadline of a delayed task, 0 otherwise.
+		uint64_t dueMs { 0 };
+		Node *next { nullptr };
+	};
+
+	TaskQueue() = default;
+	~TaskQueue();
+
+	TaskQueue(const TaskQueue&) = delete;
+	TaskQueue& operator=(const TaskQueue&) = delete;
+
+	// Must be called on the loop thread, before any post. With |keepAlive|
+	// the queue holds the loop open until close().
+	int init(uv_loop_t *loop, bool keepAlive = false);
+	// Runs what is still queued, then closes the handles. |onClosed| runs
+	// from the last close callback. Must be called on the loop thread.
+	void close(std::function<void()> onClosed = nullptr);
+
+	// Safe from any thread, also from the loop thread itself. Returns false,
+	// dropping |task|, before init() or after close().
+	bool post(std::function<void()> task);
+	bool postDelayed(std::function<void()> task, uint64_t delayMs);
+	// Takes |node| over, it is deleted once run or dropped.
+	bool post(Node *node);
+
+	Stats getStats() const;
+
+	// Keep the loop open while something is to be posted later, e.g. the
+	// completion of work running elsewhere. Loop thread only, nests.
+	void hold();
+	void release();
+
+private:
+	struct Task : Node {
+		explicit Task(std::function<void()> fn) : fn(std::move(fn)) {}
+		void run() override { fn(); }
+		std::function<void()> fn;
+	};
+
+	struct Delayed {
+		uint64_t dueMs;
+		uint64_t seq;
+		Node *task;
+		bool operator>(const Delayed &other) const {
+			return dueMs != other.dueMs ? dueMs > other.dueMs : seq > other.seq;
+		}
+	};
+
+	bool push(Node *task);
+	void drain();
+	void runDue();
+	void armTimer();
+
+	static void onAsync(uv_async_t *handle);
+	static void onTimer(uv_timer_t *handle);
+	static void onClose(uv_handle_t *handle);
+
+private:
+	uv_loop_t *loop_ { nullptr };
+	uv_thread_t loopThread_ {};
+	uv_async_t async_;
+	uv_timer_t timer_;
+	int closing_ { 0 };
+	bool keepAlive_ { false };
+	int holds_ { 0 };
+	std::function<void()> onClosed_;
+
+	// Producer side.
+	alignas(64) std::atomic<Node*> head_ { nullptr };
+	std::atomic<bool> signaled_ { false };
+	std::atomic<bool> accepting_ { false };
+	// Posts in progress, close() waits for them.
+	std::atomic<int> producers_ { 0 };
+
+	// Loop side.
+	alignas(64) std::priority_queue<Delayed, std::vector<Delayed>,
+			std::greater<Delayed>> delayed_;
+	uint64_t delayedSeq_ { 0 };
+
+	std::atomic<uint64_t> posted_ { 0 };
+	std::atomic<uint64_t> wakeups_ { 0 };
+	std::atomic<uint64_t> run_ { 0 };
+};
+
+} // namespace ndcp
+
+#endif //__NDCP_TASK_QUEUE_H__
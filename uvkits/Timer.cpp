@@ -0,0 +1,189 @@
+#include "Timer.h"
+#include <stdio.h>
+
+namespace ndcp {
+
+static constexpr uint64_t kMask = TimerWheel::kSlots - 1;
+// Furthest expiry the top level can hold, in ticks.
+static constexpr uint64_t kMaxTicks =
+		(uint64_t(1) << (TimerWheel::kBits * TimerWheel::kLevels)) - 1;
+
+static inline void unlink(TimerLink *link) {
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->prev = link->next = link;
+}
+
+static inline void pushBack(TimerLink *head, TimerLink *link) {
+	link->prev = head->prev;
+	link->next = head;
+	head->prev->next = link;
+	head->prev = link;
+}
+
+// Moves the content of |from| to the empty list |to|.
+static inline void splice(TimerLink *from, TimerLink *to) {
+	if (from->next == from)
+		return;
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	from->prev = from->next = from;
+}
+
+
+Timer::Timer(std::function<void()> callback) : callback_(std::move(callback)) {
+
+}
+
+Timer::~Timer() {
+	if (wheel_)
+		wheel_->stop(this);
+}
+
+
+TimerWheel::TimerWheel(uint64_t tickMs) : tickMs_(tickMs > 0 ? tickMs : 1) {
+
+}
+
+TimerWheel::~TimerWheel() {
+	// Detach whatever is left so the timers don't point at a dead wheel.
+	for (int level = 0; level < kLevels; level++) {
+		for (int slot = 0; slot < kSlots; slot++) {
+			TimerLink *head = &slots_[level][slot];
+			while (head->next != head) {
+				auto *timer = static_cast<Timer*>(head->next);
+				unlink(timer);
+				timer->wheel_ = nullptr;
+			}
+		}
+	}
+}
+
+int TimerWheel::init(uv_loop_t *loop) {
+	int err = uv_timer_init(loop, &handle_);
+	if (err != 0) {
+		printf("error while initializing timer wheel: %s\n", uv_strerror(err));
+		return err;
+	}
+	handle_.data = this;
+	loop_ = loop;
+	currentTick_ = uv_now(loop) / tickMs_;
+	return 0;
+}
+
+void TimerWheel::close(std::function<void()> onClosed) {
+	if (loop_ == nullptr) {
+		if (onClosed)
+			onClosed();
+		return;
+	}
+	onClosed_ = std::move(onClosed);
+	running_ = false;
+	uv_close(reinterpret_cast<uv_handle_t*>(&handle_), onClose);
+}
+
+uint64_t TimerWheel::nowTick() const {
+	if (loop_ == nullptr)
+		return currentTick_;
+	uint64_t now = uv_now(loop_) / tickMs_;
+	return now > currentTick_ ? now : currentTick_;
+}
+
+void TimerWheel::start(Timer *timer, uint64_t timeoutMs) {
+	if (timer->wheel_)
+		unlink(timer);
+	else
+		active_++;
+
+	uint64_t ticks = (timeoutMs + tickMs_ - 1) / tickMs_;
+	timer->wheel_ = this;
+	timer->expiry_ = nowTick() + (ticks > 0 ? ticks : 1);
+	place(timer);
+
+	if (!running_ && loop_ != nullptr) {
+		uv_timer_start(&handle_, onTick, tickMs_, tickMs_);
+		running_ = true;
+	}
+}
+
+void TimerWheel::stop(Timer *timer) {
+	if (timer->wheel_ != this)
+		return;
+	unlink(timer);
+	timer->wheel_ = nullptr;
+	active_--;
+}
+
+void TimerWheel::place(Timer *timer) {
+	if (timer->expiry_ - currentTick_ > kMaxTicks)
+		timer->expiry_ = currentTick_ + kMaxTicks;
+
+	// The level is the one whose slot span covers the distance, the slot is
+	// picked from the absolute expiry so it comes up exactly on time.
+	uint64_t delta = timer->expiry_ - currentTick_;
+	int level = 0;
+	while (level < kLevels - 1 && delta >> (kBits * (level + 1)) != 0)
+		level++;
+	uint64_t slot = (timer->expiry_ >> (kBits * level)) & kMask;
+	pushBack(&slots_[level][slot], timer);
+}
+
+void TimerWheel::cascade(int level) {
+	TimerLink pending;
+	splice(&slots_[level][(currentTick_ >> (kBits * level)) & kMask], &pending);
+	while (pending.next != &pending) {
+		auto *timer = static_cast<Timer*>(pending.next);
+		unlink(timer);
+		place(timer);
+	}
+}
+
+void TimerWheel::advance(uint64_t nowMs) {
+	uint64_t target = nowMs / tickMs_;
+	while (currentTick_ < target) {
+		if (active_ == 0) {
+			currentTick_ = target;
+			break;
+		}
+		currentTick_++;
+
+		// Refill the lower levels, highest first, when their span wraps.
+		int level = 0;
+		while (level < kLevels - 1 &&
+				(currentTick_ & ((uint64_t(1) << (kBits * (level + 1))) - 1)) == 0)
+			level++;
+		for (; level > 0; level--)
+			cascade(level);
+
+		TimerLink expired;
+		splice(&slots_[0][currentTick_ & kMask], &expired);
+		while (expired.next != &expired) {
+			auto *timer = static_cast<Timer*>(expired.next);
+			unlink(timer);
+			timer->wheel_ = nullptr;
+			active_--;
+			timer->callback_();
+		}
+	}
+}
+
+void TimerWheel::onTick(uv_timer_t *handle) {
+	auto *wheel = static_cast<TimerWheel*>(handle->data);
+	wheel->advance(uv_now(wheel->loop_));
+	if (wheel->active_ == 0 && wheel->running_) {
+		uv_timer_stop(&wheel->handle_);
+		wheel->running_ = false;
+	}
+}
+
+void TimerWheel::onClose(uv_handle_t *handle) {
+	auto *wheel = static_cast<TimerWheel*>(handle->data);
+	wheel->loop_ = nullptr;
+	std::function<void()> onClosed = std::move(wheel->onClosed_);
+	if (onClosed)
+		onClosed();
+}
+
+} //namespace ndcp
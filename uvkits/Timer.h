@@ -1,7 +1,97 @@
 #ifndef __NDCP_TIMER_H__
 #define __NDCP_TIMER_H__
 
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include "uv.h"
+
 namespace ndcp {
 
+class TimerWheel;
+
+/* Links of the intrusive circular lists the wheel slots are made of. */
+struct TimerLink {
+	TimerLink *prev { this };
+	TimerLink *next { this };
+};
+
+/*
+ * A one-shot timer run by a TimerWheel. The callback is set once, starting,
+ * stopping and restarting don't allocate. A Timer must not be destroyed
+ * while its callback runs, other than from inside it.
+ */
+class Timer : private TimerLink {
+public:
+	explicit Timer(std::function<void()> callback);
+	~Timer();
+
+	Timer(const Timer&) = delete;
+	Timer& operator=(const Timer&) = delete;
+
+	bool isActive() const { return wheel_ != nullptr; }
+
+private:
+	friend class TimerWheel;
+
+	std::function<void()> callback_;
+	TimerWheel *wheel_ { nullptr };
+	uint64_t expiry_ { 0 };
+};
+
+/*
+ * Hierarchical timing wheel: kLevels levels of kSlots slots, level n slots
+ * spanning kSlots^n ticks. start()/stop() are O(1), timers move one level
+ * down when their slot comes up. The wheel is advanced by a single
+ * uv_timer_t that only runs while timers are pending, so tens of thousands
+ * of connection timeouts cost one libuv timer per loop.
+ *
+ * Not thread safe, everything happens on the owning loop.
+ */
+class TimerWheel {
+public:
+	static constexpr int kBits = 6;
+	static constexpr int kSlots = 1 << kBits;
+	static constexpr int kLevels = 5;
+
+	explicit TimerWheel(uint64_t tickMs = 10);
+	~TimerWheel();
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	// Binds the wheel to |loop|. Without it the wheel only moves on advance().
+	int init(uv_loop_t *loop);
+	// Closes the driving uv timer, |onClosed| runs from its close callback.
+	void close(std::function<void()> onClosed);
+
+	// (Re)arms |timer| to fire in |timeoutMs|, rounded up to the tick.
+	void start(Timer *timer, uint64_t timeoutMs);
+	void stop(Timer *timer);
+
+	// Runs the callbacks of the timers due at |nowMs|.
+	void advance(uint64_t nowMs);
+
+	size_t size() const { return active_; }
+	uint64_t tickMs() const { return tickMs_; }
+
+private:
+	void place(Timer *timer);
+	void cascade(int level);
+	uint64_t nowTick() const;
+	static void onTick(uv_timer_t *handle);
+	static void onClose(uv_handle_t *handle);
+
+private:
+	uint64_t tickMs_;
+	uint64_t currentTick_ { 0 };
+	size_t active_ { 0 };
+	TimerLink slots_[kLevels][kSlots];
+	uv_loop_t *loop_ { nullptr };
+	uv_timer_t handle_;
+	bool running_ { false };
+	std::function<void()> onClosed_;
+};
+
 } //namespace ndcp
 #endif //__NDCP_TIMER_H__
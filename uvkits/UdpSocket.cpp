@@ -0,0 +1,420 @@
+#include "UdpSocket.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "../logger/Logging.h"
+
+namespace ndcp {
+
+// Batches read per readable event, so one busy socket can't starve the loop.
+static constexpr int kMaxReadRounds = 4;
+
+static socklen_t addrLength(const struct sockaddr *addr) {
+	return addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) :
+			sizeof(struct sockaddr_in);
+}
+
+static bool wouldBlock(int err) {
+	return err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS;
+}
+
+
+UdpSocket::UdpSocket(uv_loop_t *loop) : UdpSocket(loop, Options()) {
+
+}
+
+UdpSocket::UdpSocket(uv_loop_t *loop, const Options &options) : loop_(loop),
+		options_(options) {
+	if (options_.batchSize == 0)
+		options_.batchSize = 1;
+	if (options_.sendQueueSize < options_.batchSize)
+		options_.sendQueueSize = options_.batchSize;
+
+	const size_t batch = options_.batchSize;
+	recvBuffer_.resize(batch * options_.packetSize);
+	recvAddrs_.resize(batch);
+	recvIov_.resize(batch);
+	packets_.resize(batch);
+	for (size_t i = 0; i < batch; i++) {
+		recvIov_[i].iov_base = &recvBuffer_[i * options_.packetSize];
+		recvIov_[i].iov_len = options_.packetSize;
+	}
+
+	sendBuffer_.resize(options_.sendQueueSize * options_.packetSize);
+	sendSlots_.resize(options_.sendQueueSize);
+	sendIov_.resize(batch);
+
+#if defined(__LINUX__)
+	recvMsgs_.resize(batch);
+	sendMsgs_.resize(batch);
+	for (size_t i = 0; i < batch; i++) {
+		memset(&recvMsgs_[i], 0, sizeof(recvMsgs_[i]));
+		recvMsgs_[i].msg_hdr.msg_name = &recvAddrs_[i];
+		recvMsgs_[i].msg_hdr.msg_iov = &recvIov_[i];
+		recvMsgs_[i].msg_hdr.msg_iovlen = 1;
+		memset(&sendMsgs_[i], 0, sizeof(sendMsgs_[i]));
+		sendMsgs_[i].msg_hdr.msg_iov = &sendIov_[i];
+		sendMsgs_[i].msg_hdr.msg_iovlen = 1;
+	}
+#elif defined(__linux__)
+	LOG_FIRST_N(tuya::LS_WARNING, 1) << "UdpSocket built without __LINUX__, "
+			"sending and receiving one datagram per syscall";
+#endif
+}
+
+UdpSocket::~UdpSocket() {
+	// The handles must have been closed with close() by now.
+	if (!handlesInited_)
+		closeSocket();
+}
+
+int UdpSocket::bind(const char *ip, int port) {
+	struct sockaddr_storage addr;
+	int err = -1;
+	do {
+		if (fd_ >= 0) {
+			err = UV_EALREADY;
+			break;
+		}
+
+		if (strchr(ip, ':') != nullptr)
+			err = uv_ip6_addr(ip, port, reinterpret_cast<struct sockaddr_in6*>(&addr));
+		else
+			err = uv_ip4_addr(ip, port, reinterpret_cast<struct sockaddr_in*>(&addr));
+		if (err != 0) {
+			printf("invalid udp address %s: %s\n", ip, uv_strerror(err));
+			break;
+		}
+
+		fd_ = socket(addr.ss_family, SOCK_DGRAM, 0);
+		if (fd_ < 0) {
+			err = uv_translate_sys_error(errno);
+			printf("error while creating udp socket: %s\n", uv_strerror(err));
+			break;
+		}
+		int flags = fcntl(fd_, F_GETFL, 0);
+		if (flags < 0 || fcntl(fd_, F_SETFL, flags | O_NONBLOCK) != 0) {
+			err = uv_translate_sys_error(errno);
+			printf("error while setting udp socket non-blocking: %s\n", uv_strerror(err));
+			break;
+		}
+		if (options_.socketBufferSize > 0) {
+			// Best effort, capped by net.core.{r,w}mem_max.
+			setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &options_.socketBufferSize,
+					sizeof(options_.socketBufferSize));
+			setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &options_.socketBufferSize,
+					sizeof(options_.socketBufferSize));
+		}
+		if (::bind(fd_, reinterpret_cast<struct sockaddr*>(&addr),
+				addrLength(reinterpret_cast<struct sockaddr*>(&addr))) != 0) {
+			err = uv_translate_sys_error(errno);
+			printf("error while binding udp socket %s:%d: %s\n", ip, port, uv_strerror(err));
+			break;
+		}
+
+		err = uv_poll_init_socket(loop_, &poll_, fd_);
+		if (err != 0) {
+			printf("error while initializing udp poll: %s\n", uv_strerror(err));
+			break;
+		}
+		uv_idle_init(loop_, &idle_);
+		poll_.data = this;
+		idle_.data = this;
+		handlesInited_ = true;
+	} while (0);
+
+	if (err != 0)
+		closeSocket();
+	return err;
+}
+
+int UdpSocket::getSockName(struct sockaddr_storage *addr) const {
+	socklen_t len = sizeof(*addr);
+	if (getsockname(fd_, reinterpret_cast<struct sockaddr*>(addr), &len) != 0)
+		return uv_translate_sys_error(errno);
+	return 0;
+}
+
+int UdpSocket::startRecv(ReceiveCallback callback) {
+	if (!handlesInited_ || closing_)
+		return UV_EBADF;
+	onReceive_ = std::move(callback);
+	reading_ = true;
+	updatePoll();
+	return 0;
+}
+
+void UdpSocket::stopRecv() {
+	reading_ = false;
+	if (handlesInited_ && !closing_)
+		updatePoll();
+}
+
+void UdpSocket::updatePoll() {
+	int events = (reading_ ? UV_READABLE : 0) | (waitWritable_ ? UV_WRITABLE : 0);
+	if (events == pollEvents_)
+		return;
+	pollEvents_ = events;
+	if (events == 0)
+		uv_poll_stop(&poll_);
+	else
+		uv_poll_start(&poll_, events, onPoll);
+}
+
+int UdpSocket::receiveBatch() {
+	const size_t batch = options_.batchSize;
+	int count = 0;
+
+#if defined(__LINUX__)
+	for (size_t i = 0; i < batch; i++)
+		recvMsgs_[i].msg_hdr.msg_namelen = sizeof(recvAddrs_[i]);
+
+	do {
+		count = recvmmsg(fd_, recvMsgs_.data(), batch, MSG_DONTWAIT, nullptr);
+		recvCalls_.fetch_add(1, std::memory_order_relaxed);
+	} while (count < 0 && errno == EINTR);
+	if (count < 0)
+		return wouldBlock(errno) ? 0 : uv_translate_sys_error(errno);
+
+	for (int i = 0; i < count; i++) {
+		auto &packet = packets_[i];
+		packet.addr = reinterpret_cast<const struct sockaddr*>(&recvAddrs_[i]);
+		packet.data = static_cast<const char*>(recvIov_[i].iov_base);
+		packet.len = recvMsgs_[i].msg_len;
+		packet.truncated = (recvMsgs_[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+	}
+#else
+	for (; static_cast<size_t>(count) < batch; count++) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &recvAddrs_[count];
+		msg.msg_namelen = sizeof(recvAddrs_[count]);
+		msg.msg_iov = &recvIov_[count];
+		msg.msg_iovlen = 1;
+
+		ssize_t n;
+		do {
+			n = recvmsg(fd_, &msg, MSG_DONTWAIT);
+			recvCalls_.fetch_add(1, std::memory_order_relaxed);
+		} while (n < 0 && errno == EINTR);
+		if (n < 0) {
+			if (count > 0 || wouldBlock(errno))
+				break;
+			return uv_translate_sys_error(errno);
+		}
+
+		auto &packet = packets_[count];
+		packet.addr = reinterpret_cast<const struct sockaddr*>(&recvAddrs_[count]);
+		packet.data = static_cast<const char*>(recvIov_[count].iov_base);
+		packet.len = static_cast<size_t>(n);
+		packet.truncated = (msg.msg_flags & MSG_TRUNC) != 0;
+	}
+#endif
+
+	for (int i = 0; i < count; i++) {
+		if (packets_[i].truncated)
+			truncated_.fetch_add(1, std::memory_order_relaxed);
+	}
+	packetsReceived_.fetch_add(count, std::memory_order_relaxed);
+	return count;
+}
+
+void UdpSocket::onReadable() {
+	for (int round = 0; round < kMaxReadRounds && reading_ && !closing_; round++) {
+		int count = receiveBatch();
+		if (count < 0) {
+			// ICMP errors from earlier sends show up here, keep reading.
+			if (count != UV_ECONNREFUSED)
+				printf("error while receiving udp: %s\n", uv_strerror(count));
+			continue;
+		}
+		if (count == 0)
+			break;
+
+		onReceive_(packets_.data(), count);
+		if (static_cast<size_t>(count) < options_.batchSize)
+			break;
+	}
+
+	// Replies queued from the callback go out with this wakeup.
+	if (sendCount_ > 0 && !closing_)
+		flush();
+}
+
+int UdpSocket::send(const struct sockaddr *addr, const char *data, size_t len) {
+	if (!handlesInited_ || closing_)
+		return UV_EBADF;
+	if (len > options_.packetSize)
+		return UV_EMSGSIZE;
+
+	if (sendCount_ == sendSlots_.size()) {
+		flush();
+		if (sendCount_ == sendSlots_.size()) {
+			sendDrops_.fetch_add(1, std::memory_order_relaxed);
+			return UV_ENOBUFS;
+		}
+	}
+
+	size_t index = (sendHead_ + sendCount_) % sendSlots_.size();
+	SendSlot &slot = sendSlots_[index];
+	slot.addrLen = addrLength(addr);
+	memcpy(&slot.addr, addr, slot.addrLen);
+	memcpy(&sendBuffer_[index * options_.packetSize], data, len);
+	slot.len = len;
+	sendCount_++;
+
+	if (sendCount_ >= options_.batchSize && !waitWritable_)
+		return flush();
+
+	// Whatever is queued during this iteration goes out in the next one.
+	if (!idleActive_ && !waitWritable_) {
+		uv_idle_start(&idle_, onIdle);
+		idleActive_ = true;
+	}
+	return 0;
+}
+
+int UdpSocket::flush() {
+	if (!handlesInited_ || closing_)
+		return UV_EBADF;
+
+	int err = 0;
+	while (sendCount_ > 0) {
+		size_t count = sendCount_ < options_.batchSize ? sendCount_ : options_.batchSize;
+		for (size_t i = 0; i < count; i++) {
+			size_t index = (sendHead_ + i) % sendSlots_.size();
+			sendIov_[i].iov_base = &sendBuffer_[index * options_.packetSize];
+			sendIov_[i].iov_len = sendSlots_[index].len;
+#if defined(__LINUX__)
+			sendMsgs_[i].msg_hdr.msg_name = &sendSlots_[index].addr;
+			sendMsgs_[i].msg_hdr.msg_namelen = sendSlots_[index].addrLen;
+#endif
+		}
+
+		int sent = 0;
+#if defined(__LINUX__)
+		sent = sendmmsg(fd_, sendMsgs_.data(), count, MSG_DONTWAIT);
+		sendCalls_.fetch_add(1, std::memory_order_relaxed);
+		if (sent < 0)
+			err = errno;
+#else
+		for (; static_cast<size_t>(sent) < count; sent++) {
+			size_t index = (sendHead_ + sent) % sendSlots_.size();
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name = &sendSlots_[index].addr;
+			msg.msg_namelen = sendSlots_[index].addrLen;
+			msg.msg_iov = &sendIov_[sent];
+			msg.msg_iovlen = 1;
+			sendCalls_.fetch_add(1, std::memory_order_relaxed);
+			if (sendmsg(fd_, &msg, MSG_DONTWAIT) < 0) {
+				err = errno;
+				break;
+			}
+		}
+		if (sent > 0)
+			err = 0;
+#endif
+
+		if (sent <= 0) {
+			if (err == EINTR)
+				continue;
+			if (wouldBlock(err)) {
+				// Socket buffer full, carry on when it drains.
+				waitWritable_ = true;
+				updatePoll();
+				err = 0;
+				break;
+			}
+			// Refused or unreachable destination, drop that datagram.
+			sendDrops_.fetch_add(1, std::memory_order_relaxed);
+			sent = 1;
+			err = uv_translate_sys_error(err);
+		}
+
+		sendHead_ = (sendHead_ + sent) % sendSlots_.size();
+		sendCount_ -= sent;
+		packetsSent_.fetch_add(sent, std::memory_order_relaxed);
+	}
+
+	if (sendCount_ == 0 && waitWritable_) {
+		waitWritable_ = false;
+		updatePoll();
+	}
+	if (idleActive_) {
+		uv_idle_stop(&idle_);
+		idleActive_ = false;
+	}
+	return err;
+}
+
+void UdpSocket::close(std::function<void()> onClosed) {
+	if (closing_)
+		return;
+	if (!handlesInited_) {
+		closeSocket();
+		if (onClosed)
+			onClosed();
+		return;
+	}
+
+	closing_ = true;
+	reading_ = false;
+	onClosed_ = std::move(onClosed);
+	pendingCloses_ = 2;
+	uv_close(reinterpret_cast<uv_handle_t*>(&poll_), onClose);
+	uv_close(reinterpret_cast<uv_handle_t*>(&idle_), onClose);
+}
+
+void UdpSocket::closeSocket() {
+	if (fd_ >= 0) {
+		::close(fd_);
+		fd_ = -1;
+	}
+}
+
+UdpSocket::Stats UdpSocket::getStats() const {
+	return Stats {
+		packetsReceived_.load(std::memory_order_relaxed),
+		packetsSent_.load(std::memory_order_relaxed),
+		recvCalls_.load(std::memory_order_relaxed),
+		sendCalls_.load(std::memory_order_relaxed),
+		truncated_.load(std::memory_order_relaxed),
+		sendDrops_.load(std::memory_order_relaxed),
+	};
+}
+
+void UdpSocket::onPoll(uv_poll_t *handle, int status, int events) {
+	auto *socket = static_cast<UdpSocket*>(handle->data);
+	if (status < 0) {
+		printf("udp poll error: %s\n", uv_strerror(status));
+		return;
+	}
+	if ((events & UV_WRITABLE) != 0)
+		socket->flush();
+	if ((events & UV_READABLE) != 0)
+		socket->onReadable();
+}
+
+void UdpSocket::onIdle(uv_idle_t *handle) {
+	static_cast<UdpSocket*>(handle->data)->flush();
+}
+
+void UdpSocket::onClose(uv_handle_t *handle) {
+	auto *socket = static_cast<UdpSocket*>(handle->data);
+	if (--socket->pendingCloses_ > 0)
+		return;
+
+	// The fd can only go once the poll handle no longer watches it.
+	socket->closeSocket();
+	socket->handlesInited_ = false;
+	socket->closing_ = false;
+	std::function<void()> onClosed = std::move(socket->onClosed_);
+	if (onClosed)
+		onClosed();
+}
+
+} //namespace ndcp
@@ -0,0 +1,147 @@
+#ifndef __NDCP_UDP_SOCKET_H__
+#define __NDCP_UDP_SOCKET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "uv.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace ndcp {
+
+/* One datagram of a receive batch, valid during the receive callback. */
+struct UdpPacket {
+	const struct sockaddr *addr;
+	const char *data;
+	size_t len;
+	// The datagram was longer than Options::packetSize.
+	bool truncated;
+};
+
+/*
+ * Non-blocking UDP socket polled by the loop that moves datagrams in batches:
+ * one recvmmsg()/sendmmsg() call per batch on Linux, one recvmsg()/sendmsg()
+ * per datagram elsewhere. The batched calls are only compiled in when the
+ * build defines __LINUX__, like the other Linux specific code; a Linux build
+ * without it logs a warning once and falls back to one call per datagram.
+ *
+ * Received datagrams land in a ring of batchSize preallocated slots and are
+ * handed to the callback a batch at a time. send() copies the datagram into
+ * a preallocated send ring, which is flushed once per loop iteration, when a
+ * batch is full, or by flush(). Nothing is allocated per packet.
+ *
+ * POSIX only. Not thread safe, everything happens on the owning loop; only
+ * the stats may be read from other threads.
+ */
+class UdpSocket {
+public:
+	struct Options {
+		// Datagrams per recvmmsg()/sendmmsg() call.
+		size_t batchSize { 64 };
+		// Largest datagram received or sent, longer ones are truncated.
+		size_t packetSize { 2048 };
+		// Datagrams waiting to be sent, send() fails beyond that.
+		size_t sendQueueSize { 1024 };
+		// SO_RCVBUF/SO_SNDBUF, 0 keeps the system default.
+		int socketBufferSize { 0 };
+	};
+
+	struct Stats {
+		uint64_t packetsReceived;
+		uint64_t packetsSent;
+		uint64_t recvCalls;
+		uint64_t sendCalls;
+		uint64_t truncated;
+		uint64_t sendDrops;  // queue full or refused by the kernel
+	};
+
+	using ReceiveCallback = std::function<void(const UdpPacket *packets, size_t count)>;
+
+	explicit UdpSocket(uv_loop_t *loop);
+	UdpSocket(uv_loop_t *loop, const Options &options);
+	~UdpSocket();
+
+	UdpSocket(const UdpSocket&) = delete;
+	UdpSocket& operator=(const UdpSocket&) = delete;
+
+	// Opens the socket on |ip| (v4 or v6) and |port|, 0 picks a free port.
+	int bind(const char *ip, int port);
+	int getSockName(struct sockaddr_storage *addr) const;
+
+	int startRecv(ReceiveCallback callback);
+	void stopRecv();
+
+	// Queues a datagram. Returns 0, UV_EMSGSIZE or UV_ENOBUFS.
+	int send(const struct sockaddr *addr, const char *data, size_t len);
+	// Sends what the kernel takes now, the rest goes when it is writable.
+	int flush();
+	size_t queuedPackets() const { return sendCount_; }
+
+	// Closes the socket, |onClosed| runs once the loop is done with it.
+	void close(std::function<void()> onClosed);
+
+	Stats getStats() const;
+
+private:
+	struct SendSlot {
+		struct sockaddr_storage addr;
+		socklen_t addrLen;
+		size_t len;
+	};
+
+	int receiveBatch();
+	void onReadable();
+	void updatePoll();
+	void closeSocket();
+	static void onPoll(uv_poll_t *handle, int status, int events);
+	static void onIdle(uv_idle_t *handle);
+	static void onClose(uv_handle_t *handle);
+
+private:
+	uv_loop_t *loop_;
+	Options options_;
+	uv_os_sock_t fd_ { -1 };
+	uv_poll_t poll_;
+	uv_idle_t idle_;
+	bool handlesInited_ { false };
+	bool reading_ { false };
+	bool waitWritable_ { false };
+	bool idleActive_ { false };
+	bool closing_ { false };
+	int pollEvents_ { 0 };
+	int pendingCloses_ { 0 };
+	ReceiveCallback onReceive_;
+	std::function<void()> onClosed_;
+
+	// Receive ring, batchSize slots of packetSize bytes.
+	std::vector<char> recvBuffer_;
+	std::vector<struct sockaddr_storage> recvAddrs_;
+	std::vector<struct iovec> recvIov_;
+	std::vector<UdpPacket> packets_;
+
+	// Send ring, sendQueueSize slots of packetSize bytes.
+	std::vector<char> sendBuffer_;
+	std::vector<SendSlot> sendSlots_;
+	std::vector<struct iovec> sendIov_;
+	size_t sendHead_ { 0 };
+	size_t sendCount_ { 0 };
+
+#if defined(__LINUX__)
+	std::vector<struct mmsghdr> recvMsgs_;
+	std::vector<struct mmsghdr> sendMsgs_;
+#endif
+
+	std::atomic<uint64_t> packetsReceived_ { 0 };
+	std::atomic<uint64_t> packetsSent_ { 0 };
+	std::atomic<uint64_t> recvCalls_ { 0 };
+	std::atomic<uint64_t> sendCalls_ { 0 };
+	std::atomic<uint64_t> truncated_ { 0 };
+	std::atomic<uint64_t> sendDrops_ { 0 };
+};
+
+} //namespace ndcp
+#endif //__NDCP_UDP_SOCKET_H__